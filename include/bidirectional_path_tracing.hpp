@@ -0,0 +1,47 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "ray_tracing.hpp"
+#include "object_set.hpp"
+#include "path_tracing.hpp"
+
+#include <thread>
+#include <vector>
+
+/* Bidirectional path tracing [Veach 1997]. Every camera sample also traces a
+   subpath from one of the point lights, and every pair of vertices of both
+   subpaths is connected with a shadow ray. Paths found by several
+   strategies are weighted with the power heuristic, so caustics are found
+   by connecting light subpaths directly to the camera. Those connections
+   may land on any pixel, so each worker splats them on its own film.
+   Area emitters are only found by camera subpaths. */
+
+namespace BidirectionalPathTracing {
+
+// Same division of the image as the path tracer
+using PathTracing::Task;
+using PathTracing::TaskQueue;
+using PathTracing::TaskDivider;
+
+class Renderer
+{
+private:
+    std::vector<std::thread> threadPool;
+    std::thread leader;
+    TaskQueue tasks;
+    TaskDivider taskDivider;
+    Index maxDepth;
+public:
+    static constexpr Index totalConcurrency = 0;
+
+    // Paths have up to `maxDepth` bounces
+    Renderer(const Index numWorkers, const Index queueSize,
+            const TaskDivider& divider, Index maxDepth = 16);
+
+    void render(const Camera& cam, Image& img,
+            const ObjectSet& objects, Index ppp);
+
+    Index numThreads();
+};
+
+} //namespace BidirectionalPathTracing
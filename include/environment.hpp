@@ -0,0 +1,84 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "shading.hpp"
+#include "random.hpp"
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+class Image;
+
+/* Walker's alias method. Builds in linear time a table that picks index i
+   with probability proportional to weights[i] with one random number. */
+class AliasTable
+{
+private:
+    struct Bin
+    {
+        Real probability; // of keeping this bin instead of its alias
+        Index alias;
+    };
+
+    std::vector<Bin> bins;
+    std::vector<Real> probabilities;
+
+public:
+    AliasTable() = default;
+
+    AliasTable(const std::vector<Real>& weights);
+
+    inline bool empty() const { return bins.empty(); }
+
+    Index sample(Randomizer& random) const;
+
+    // Probability of picking index `i`
+    inline Real probability(Index i) const { return probabilities[i]; }
+};
+
+/* Infinitely distant light around the scene, from a latitude-longitude
+   image: rows go from the +y pole (top) to the -y pole (bottom), and the
+   columns around the y axis, starting at +z and towards +x. Directions are
+   importance sampled proportionally to the luminance of the pixels times
+   the solid angle they cover. */
+class EnvironmentLight
+{
+private:
+    std::vector<Color> pixels;
+    Index width, height;
+    AliasTable table;
+    Real sceneRadius;
+
+    // Index of the pixel seen in direction `d`
+    Index pixel(const Direction& d) const;
+
+public:
+    // Radiance of the image scaled by `scale`. The scene is inside the
+    // sphere of radius `radius` around the origin.
+    EnvironmentLight(const Image& image, const Color& scale, Real radius);
+
+    // Radiance arriving from direction `d` (pointing away from the scene)
+    Color radiance(const Direction& d) const;
+
+    struct Sample
+    {
+        Direction d; // pointing away from the scene
+        Color radiance;
+        Real pdf; // solid angle density
+    };
+
+    Sample sample(Randomizer& random) const;
+
+    // Solid angle density with which `sample` returns direction `d`
+    Real pdf(const Direction& d) const;
+
+    inline Real radius() const { return sceneRadius; }
+
+    // Luminance of the flux entering the scene sphere
+    Real power() const;
+};
+
+// Loads the environment from a PPM or BMP image, nullptr if it cannot be read
+std::unique_ptr<EnvironmentLight> makeEnvironmentLight(std::string_view path,
+        const Color& scale, Real radius);
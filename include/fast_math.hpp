@@ -0,0 +1,122 @@
+#pragma once
+
+#include "numbers.hpp"
+#include "geometry.hpp"
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+/* Polynomial approximations of elementary functions for the hot paths of the
+   renderer. test/test_fast_math checks these maximum errors, and
+   test/benchmark_fast_math compares their speed against the standard
+   library.
+
+       function   max error                            libm
+       sincos     2e-7 for |x| <= 2pi, 6e-6 <= 100     std::sin, std::cos
+       acos       5e-7                                 std::acos
+       rsqrt      5e-6 relative                        1 / std::sqrt
+
+   rsqrt is only worth it without -Ofast, which already turns 1 / sqrt into
+   a hardware estimate and a Newton-Raphson step.
+
+   It also has forms of refraction and hemisphere sampling that need no
+   trigonometric function of the standard library. */
+
+namespace fastmath {
+
+struct SinCos
+{
+    Real sin, cos;
+};
+
+// Sine and cosine of `x` at once. The argument is reduced to [-pi/4, pi/4]
+// and evaluated with the minimax polynomials of the Cephes library.
+inline SinCos sincos(Real x)
+{
+    constexpr Real twoOverPi = 0.636619772367581343;
+    // pi/2 split in three parts, so that multiples of it are exact
+    constexpr Real c1 = 1.5703125, c2 = 4.837512969970703125e-4,
+                   c3 = 7.54978995489188216e-8;
+
+    const Real q = std::floor(x * twoOverPi + Real(0.5));
+    const Real r = ((x - q * c1) - q * c2) - q * c3;
+    const Real r2 = r * r;
+
+    const Real s = r + r * r2 * (Real(-1.6666654611e-1)
+                              + r2 * (Real(8.3321608736e-3)
+                              + r2 * Real(-1.9515295891e-4)));
+    const Real c = 1 - r2 * Real(0.5) + r2 * r2 * (Real(4.166664568298827e-2)
+                                      + r2 * (Real(-1.388731625493765e-3)
+                                      + r2 * Real(2.443315711809948e-5)));
+
+    // Quadrant of x, without branches
+    const int64_t quadrant = static_cast<int64_t>(q);
+    const Real sinSign = quadrant & 2 ? -1 : 1;
+    const Real cosSign = (quadrant + 1) & 2 ? -1 : 1;
+    return quadrant & 1 ? SinCos{c * sinSign, s * cosSign}
+                        : SinCos{s * sinSign, c * cosSign};
+}
+
+// Arc cosine of `x`, clamped to [-1, 1], with the 7th degree polynomial of
+// Abramowitz and Stegun (4.4.46).
+inline Real acos(Real x)
+{
+    const bool negative = x < 0;
+    const Real a = numbers::min(std::abs(x), Real(1));
+
+    const Real p = Real(1.5707963050)
+            + a * (Real(-0.2145988016)
+            + a * (Real(0.0889789874)
+            + a * (Real(-0.0501743046)
+            + a * (Real(0.0308918810)
+            + a * (Real(-0.0170881256)
+            + a * (Real(0.0066700901)
+            + a * Real(-0.0012624911)))))));
+    const Real result = std::sqrt(1 - a) * p;
+
+    return negative ? numbers::pi - result : result;
+}
+
+// 1 / sqrt(x) for positive normal `x`: bit level first guess refined with
+// two Newton-Raphson steps.
+inline Real rsqrt(Real x)
+{
+    static_assert(sizeof(Real) == sizeof(uint32_t), "rsqrt needs 32 bit reals");
+
+    Real y = std::bit_cast<Real>(0x5f375a86 - (std::bit_cast<uint32_t>(x) >> 1));
+    const Real half = x * Real(0.5);
+    y = y * (Real(1.5) - half * y * y);
+    y = y * (Real(1.5) - half * y * y);
+    return y;
+}
+
+// Cosine-weighted direction of the hemisphere around +z from two uniform
+// numbers in [0, 1), as the projection of a uniform point of the unit disk.
+inline Direction cosineHemisphere(Real u1, Real u2)
+{
+    const Real sinLat = std::sqrt(u1);
+    const Real cosLat = std::sqrt(1 - u1);
+    const auto [sinAz, cosAz] = sincos(2 * numbers::pi * u2);
+    return {sinLat * cosAz, sinLat * sinAz, cosLat};
+}
+
+struct Refraction
+{
+    Direction d;
+    bool total; // total internal reflection, `d` is the reflected direction
+};
+
+// Direction `d` refracted by Snell's law through a surface whose normal `n`
+// points to the side it goes into (dot(d, n) >= 0), with `eta` the ratio of
+// the refractive indices of the side it comes from and the one it goes into.
+inline Refraction refract(const Direction& d, const Direction& n, Real eta)
+{
+    const Real cosIn = dot(d, n);
+    const Real k = 1 - eta * eta * (1 - cosIn * cosIn); // squared cosine out
+    if (k < 0)
+        return {d - 2 * n * cosIn, true};
+    return {eta * d + n * (std::sqrt(k) - eta * cosIn), false};
+}
+
+} //namespace fastmath
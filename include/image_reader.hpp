@@ -33,7 +33,7 @@ public:
     [[nodiscard]] virtual bool read(Image& img) override { return bmp::read(is, img); }
 };
 
-[[nodiscard]] std::unique_ptr<ImageReader> makeImageReader(std::string_view path)
+[[nodiscard]] inline std::unique_ptr<ImageReader> makeImageReader(std::string_view path)
 {
     std::ifstream is{std::string{path}, std::ios::binary};
     if (!is.is_open())
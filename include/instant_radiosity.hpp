@@ -0,0 +1,53 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "ray_tracing.hpp"
+#include "object_set.hpp"
+#include "path_tracing.hpp"
+
+#include <thread>
+#include <vector>
+
+/* Instant radiosity [Keller 1997]. Light paths traced from the point lights
+   leave virtual point lights (VPLs) at every diffuse hit, which then light
+   the diffuse hits of camera rays as if they were point lights. Their
+   contribution is clamped, setting a minimum distance to the shaded point,
+   so that they do not show up as bright spots. Direct light comes from the
+   actual lights of the scene. The samples of a pixel gather interleaved
+   subsets of the VPLs, so the cost per pixel only depends on their number. */
+
+namespace InstantRadiosity {
+
+// Same division of the image as the path tracer
+using PathTracing::Task;
+using PathTracing::TaskQueue;
+using PathTracing::TaskDivider;
+
+// Diffuse surface point lit by a light path
+struct VirtualPointLight
+{
+    Point position;
+    Direction normal;
+    Color intensity; // radiant intensity along the normal
+};
+
+class Renderer
+{
+private:
+    std::vector<std::thread> threadPool;
+    std::thread leader;
+    TaskQueue tasks;
+    TaskDivider taskDivider;
+public:
+    static constexpr Index totalConcurrency = 0;
+
+    Renderer(const Index numWorkers, const Index queueSize,
+            const TaskDivider& divider);
+
+    void render(const Camera& cam, Image& img, const ObjectSet& objects,
+            Index ppp, Index numLights, Real minDistance);
+
+    Index numThreads();
+};
+
+} //namespace InstantRadiosity
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "ray_tracing.hpp"
+#include "shading.hpp"
+
+#include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+/* Irradiance cache [Ward et al. 1988] with gradients [Ward & Heckbert 1992].
+   Irradiance is computed by stratified hemisphere sampling at sparse records
+   and extrapolated to nearby points using its translational and rotational
+   gradients. Records are created lazily when no record is valid at a point,
+   and they are stored in an octree shared by every worker thread. */
+
+class IrradianceCache
+{
+public:
+    // Incoming radiance along a ray and distance to the surface it hits
+    struct RadianceSample
+    {
+        Color radiance;
+        Real distance;
+    };
+
+private:
+    struct Record
+    {
+        Point p;
+        Direction n;
+        Color e;
+        Real radius;                  // harmonic mean distance to surrounding surfaces
+        std::array<Color, 3> gradT;   // translational gradient (x, y, z)
+        std::array<Color, 3> gradR;   // rotational gradient (x, y, z)
+    };
+
+    struct Node
+    {
+        std::array<Index, 8> children {}; // 0 if there is no child
+        std::vector<Index> records;
+    };
+
+    // Stratification of the hemisphere: M divisions of the elevation and N
+    // divisions of the azimuth (N ~ pi * M)
+    static constexpr Index thetaDivisions = 6;
+    static constexpr Index phiDivisions = 18;
+
+    // Radii of the records, relative to the width of the image at their
+    // distance from the camera, so that they suit the scale of any scene
+    static constexpr Real minRadius = 1.0 / 64;
+    static constexpr Real maxRadius = 2.0 / 3;
+
+    const Real error;
+    Point eye;
+    Real spread = 1; // Width of the image at unit distance from `eye`
+
+    mutable std::shared_mutex mtx;
+    std::vector<Record> records;
+    std::vector<Node> nodes;
+    Point rootCenter;
+    Real rootHalfSize = 0;
+
+    void grow(const Point& p, Real halfSize);
+
+    void insert(Index node, const Point& center, Real halfSize,
+            const Point& min, const Point& max, Index record);
+
+    bool interpolate(const Point& p, const Direction& n, Color& e) const;
+
+    Record computeRecord(const Point& p, const Direction& n,
+            const std::vector<RadianceSample>& samples,
+            const Direction& u, const Direction& v) const;
+
+public:
+    // `error` is the maximum allowed error (`a` in Ward's paper),
+    // lower values produce more records.
+    IrradianceCache(Real error);
+
+    Real maxError() const { return error; }
+
+    // Camera whose image sets the minimum and maximum radii of the records
+    void setView(const Camera& cam);
+
+    Index size() const;
+
+    // Returns the irradiance at `p`, computing a new record with
+    // `radiance(ray)` if no stored record is valid.
+    template <typename RadianceFunction>
+    Color irradiance(const Point& p, const Direction& n,
+            RadianceFunction&& radiance, Randomizer& random);
+};
+
+#include "inline/irradiance_cache.ipp"
@@ -19,3 +19,18 @@ public:
 
     inline Color color() const { return e; }
 };
+
+// Bounded shape with an emitter material. The shape is owned by its object.
+class AreaLight
+{
+private:
+    const Shape* s;
+    Color e;
+public:
+    AreaLight(const Shape* shape, Color emission)
+        : s{shape}, e{emission} {}
+
+    inline const Shape& shape() const { return *s; }
+
+    inline Color color() const { return e; }
+};
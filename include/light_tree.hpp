@@ -0,0 +1,63 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "light.hpp"
+#include "random.hpp"
+
+#include <vector>
+
+/* Bounding volume hierarchy over point lights. Every node stores the bounds,
+   the total power and the orientation cone of its lights, which gives an
+   estimate of how much they can contribute to a shading point. Lights are
+   picked descending the tree and choosing children proportionally to their
+   estimated contribution. */
+
+class LightTree
+{
+public:
+    // Directions of emission: every light emits inside `offset` radians
+    // around `axis`, spreading up to `emission` radians further.
+    struct Cone
+    {
+        Direction axis;
+        Real offset, emission;
+    };
+
+    struct Node
+    {
+        Point min, max;
+        Real power;
+        Cone cone;
+        Index left, right; // children, leaves store their light in `left`
+        bool leaf;
+    };
+
+    struct Sample
+    {
+        Index light;
+        Real pdf; // 0 if no light can reach the shading point
+    };
+
+private:
+    std::vector<Node> nodes;
+    Index samples = 0;
+
+    Index build(const std::vector<PointLight>& lights, std::vector<Index>& order,
+            Index begin, Index end);
+
+    Real importance(const Node& node, const Point& p, const Direction& n) const;
+
+public:
+    LightTree() = default;
+
+    LightTree(const std::vector<PointLight>& lights, Index samplesPerPoint);
+
+    inline bool empty() const { return nodes.empty(); }
+
+    inline Index size() const { return nodes.size(); }
+
+    // Number of lights to pick at every shading point
+    inline Index samplesPerPoint() const { return samples; }
+
+    Sample sample(const Point& p, const Direction& n, Randomizer& random) const;
+};
@@ -6,12 +6,25 @@
 #include "ray_tracing.hpp"
 #include "shapes.hpp"
 
+// Direction of the hemisphere around `normal`, with a density proportional
+// to the cosine with it
+Direction uniformCosineSampling(const Direction& normal, Randomizer& random);
+
 class Material
 {
 private:
     bool emits = false;
     Color _kd, _ks, _kt;
     Real index = 0; 
+
+    struct Probabilities
+    {
+        Real pd, ps, pt;
+    };
+
+    // Probability of choosing each component in eval, leaving some
+    // probability of absorption
+    Probabilities evalProbabilities() const;
 public:
 
     friend Material emitter(const Color& ke);
@@ -36,6 +49,10 @@ public:
     Material::Evaluation eval(const Point& hit, const Ray& wIn, Ray& wOut,
             const Shape::Normal& normal, Randomizer& random) const;
 
+    // Solid angle density with which eval samples `wOut` with the diffuse
+    // component, around the normal of the incident side.
+    Real diffusePdf(const Direction& normal, const Direction& wOut) const;
+
     struct Emission
     {
         bool emits;
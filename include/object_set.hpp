@@ -5,6 +5,9 @@
 
 #include "shapes.hpp"
 #include "light.hpp"
+#include "light_tree.hpp"
+#include "shadow_maps.hpp"
+#include "environment.hpp"
 #include "materials.hpp"
 
 class Object
@@ -27,4 +30,8 @@ struct ObjectSet
 {
     std::vector<Object> objects;
     std::vector<PointLight> pointLights;
+    std::vector<AreaLight> areaLights; // emitter objects that can be sampled
+    LightTree lightTree; // if not empty, point lights are sampled from it
+    ShadowMaps shadowMaps; // if not empty, approximate point light shadows
+    std::shared_ptr<const EnvironmentLight> environment; // seen by rays that miss, if any
 };
\ No newline at end of file
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "random.hpp"
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+/* Path guiding with a spatio-directional tree [Müller et al. 2017]. A binary
+   tree subdivides space and each of its leaves holds a quadtree over the
+   sphere of directions that learns the incident radiance of that region.
+   Training is done in passes: radiance recorded during a pass refines both
+   trees and becomes the sampling distribution of the next pass. */
+
+// Quadtree over the cylindrical mapping of the sphere (cos(theta), phi),
+// which preserves areas.
+class DirectionalTree
+{
+private:
+    struct Node
+    {
+        std::array<std::atomic<Real>, 4> sum {};
+        std::array<Index, 4> child {}; // 0 if the quadrant is a leaf
+
+        Node() = default;
+        Node(const Node& other);
+        Node& operator=(const Node& other);
+
+        Real total() const;
+    };
+
+    static constexpr Index maxDepth = 20;
+
+    std::vector<Node> nodes;
+
+    void refine(const DirectionalTree& previous, Index src, Index dst,
+            Real total, Real threshold, Index depth);
+
+public:
+    // Diffuse bounces sample the tree with this probability, and a cosine
+    // lobe otherwise
+    static constexpr Real guidedFraction = 0.5;
+
+    DirectionalTree();
+
+    void record(const Direction& d, Real radiance);
+
+    // Same structure adapted to the recorded radiance, but without records.
+    // Quadrants with more than `threshold` of the total energy are subdivided.
+    DirectionalTree refined(Real threshold) const;
+
+    Direction sample(Randomizer& random) const;
+
+    Real pdf(const Direction& d) const;
+
+    // Samples restricted to the hemisphere around `normal`: directions below
+    // it are mirrored instead of wasted, so the densities of both add up.
+    Direction sample(const Direction& normal, Randomizer& random) const;
+
+    Real pdf(const Direction& d, const Direction& normal) const;
+
+    // Pdf of the mixture of the tree and a cosine lobe with pdf `cosinePdf`
+    Real mixturePdf(const Direction& d, const Direction& normal, Real cosinePdf) const
+    {
+        return (1 - guidedFraction) * cosinePdf + guidedFraction * pdf(d, normal);
+    }
+};
+
+class GuidingTree
+{
+private:
+    struct Node
+    {
+        Point min, max;
+        std::array<Index, 2> child {}; // leaves have no children
+        bool leaf = true;
+        DirectionalTree sampling, building;
+        std::atomic<Index> samples {0};
+    };
+
+    // Spatial leaves are split when they get more than
+    // `splitThreshold * sqrt(2^pass)` samples
+    static constexpr Real splitThreshold = 1000;
+    static constexpr Real energyThreshold = 0.01;
+
+    std::deque<Node> nodes;
+
+    Index leafAt(const Point& p) const;
+
+public:
+    GuidingTree(const Point& min, const Point& max);
+
+    // Learnt distribution of incident radiance at p
+    const DirectionalTree& distribution(const Point& p) const;
+
+    void record(const Point& p, const Direction& d, Real radiance);
+
+    // Refines the tree with the radiance recorded during training pass `pass`
+    void refine(Index pass);
+
+    Index size() const { return nodes.size(); }
+};
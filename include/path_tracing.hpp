@@ -5,10 +5,16 @@
 #include "shapes.hpp"
 #include "light.hpp"
 #include "object_set.hpp"
+#include "irradiance_cache.hpp"
+#include "path_guiding.hpp"
 
 #include "queue/concurrent_bounded_queue.hpp"
 #include "progress_bar/text_progress_bar.hpp"
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string_view>
 #include <thread>
 #include <vector>
 
@@ -38,9 +44,19 @@ public:
     bool getNextTask(Task& task);
 };
 
-Color traceProjection(const ObjectSet& objSet, const Ray& ray, Randomizer&);
-Color traceDirectLight(const ObjectSet& objSet, const Ray& ray, Randomizer&);
-Color traceIndirectLightRecursive(const ObjectSet& objSet, const Ray& ray, Randomizer& random);
+// Settings of a render, only indirect light strategies make use of them
+struct TraceOptions
+{
+    Index split = 1; // secondary paths traced from the first diffuse hit
+    IrradianceCache* irradianceCache = nullptr; // indirect light at the first diffuse hit
+    GuidingTree* guidingTree = nullptr; // guides diffuse bounces if not null
+    bool trainGuiding = false;          // record radiance in the guiding tree
+};
+
+Color traceProjection(const ObjectSet& objSet, const Ray& ray, Randomizer&, const TraceOptions&);
+Color traceDirectLight(const ObjectSet& objSet, const Ray& ray, Randomizer&, const TraceOptions&);
+Color traceIndirectLightRecursive(const ObjectSet& objSet, const Ray& ray, Randomizer& random,
+        const TraceOptions& options);
 
 using TraceFunction = decltype(traceProjection)*;
 
@@ -48,6 +64,7 @@ enum class Strategy : uint8_t
 {
     trace_projection,
     trace_direct_light,
+    resample_direct_light,
     recursive,
     iterative
 };
@@ -57,14 +74,41 @@ class Renderer
 private:
     std::vector<std::thread> threadPool;
     std::thread leader;
+    const Index queueSize;
     TaskQueue tasks;
     TaskDivider taskDivider;
+    Strategy strategy;
+    TraceOptions options;
+    std::unique_ptr<IrradianceCache> irradianceCache;
+    Index guidingPasses;
+    std::unique_ptr<GuidingTree> guidingTree;
+    Real noiseThreshold;
+    std::atomic<Index> samplesTaken;
+    Index indirectDownsampling;
     TraceFunction trace;
+
+    // Starts a worker of a pass, given its progress increment per task
+    using WorkerLauncher = std::function<std::thread(Real, TextProgressBar&)>;
+
+    void runPass(TaskQueue& queue, TaskDivider& divider, std::string_view message,
+            const WorkerLauncher& launch);
+
+    void renderPass(const Camera& cam, Image& img, const ObjectSet& objects, Index ppp,
+            TaskQueue& queue, TaskDivider& divider, std::string_view message);
+
+    // Diffuse indirect light at the first hit at a lower resolution
+    void renderDownsampled(const Camera& cam, Image& img, const ObjectSet& objects, Index ppp);
 public:
     static constexpr Index totalConcurrency = 0;
 
+    // With a `noiseThreshold` (relative error), pixels stop sampling as soon
+    // as they reach it, taking `ppp` samples at most. With an
+    // `indirectDownsampling` factor over 1, diffuse indirect light at the
+    // first hit is traced at that fraction of the resolution.
     Renderer(const Index numWorkers, const Index queueSize,
-            const TaskDivider& divider, Strategy strategy);
+            const TaskDivider& divider, Strategy strategy, Index splitFactor = 1,
+            Real irradianceCacheError = 0, Index guidingTrainingPasses = 0,
+            Real noiseThreshold = 0, Index indirectDownsampling = 1);
 
     void render(const Camera& cam, Image& img, const ObjectSet& objects, Index ppp);
 
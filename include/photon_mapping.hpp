@@ -6,10 +6,12 @@
 #include "light.hpp"
 #include "object_set.hpp"
 
-#include "kdtree/kdtree.hpp"
+#include "kdtree/bucket_kdtree.hpp"
+#include "kdtree/hash_grid.hpp"
 #include "queue/concurrent_bounded_queue.hpp"
 #include "progress_bar/text_progress_bar.hpp"
 
+#include <cstdint>
 #include <thread>
 #include <vector>
 
@@ -39,15 +41,45 @@ public:
     bool getNextTask(Task& task);
 };
 
+/* Flux in a shared exponent format (RGBE): an 8 bit mantissa per channel
+   and the exponent of the largest one, stored as the biased exponent of a
+   float so that decoding is a product per channel. Mantissas are rounded, so
+   channels are within 0.4% of the largest one. */
+class PackedFlux
+{
+private:
+    std::uint8_t r, g, b, e;
+public:
+    PackedFlux() = default;
+    explicit PackedFlux(const Color& flux);
+
+    operator Color() const;
+};
+
+// Unit direction in 16 bits, with an octahedral map quantized to 8 bits per
+// coordinate. Decoded directions are within 1 degree of the original.
+class PackedDirection
+{
+private:
+    std::uint8_t u, v;
+public:
+    PackedDirection() = default;
+    explicit PackedDirection(const Direction& d);
+
+    operator Direction() const;
+};
+
+// Photons are read by the gather straight from the map, so they are packed
+// to fit more of them in the caches
 struct Photon
 {
     Point position;
-    Color flux;
-    Real lat, az;
+    PackedFlux flux;
+    PackedDirection incoming;
 
     Photon() = default;
-    inline Photon(const Point& p, const Color& f, Real theta, Real phi)
-        : position{p}, flux{f}, lat{theta}, az{phi}
+    inline Photon(const Point& p, const Color& f, const Direction& d)
+        : position{p}, flux{f}, incoming{d}
     {}
 
     struct KDTreeAccessor
@@ -59,18 +91,21 @@ struct Photon
     };
 };
 
-// Includes pointer to the shape in order to implement exclusive evaluation
+// Includes the index of the object of the scene it hit in order to implement
+// exclusive evaluation
 struct SPhoton
 {
+    static constexpr Index maxObjects = Index{1} << 16;
+
     Point position;
-    Color flux;
-    Real lat, az;
-    const Shape* shape;
+    PackedFlux flux;
+    PackedDirection incoming;
+    std::uint16_t object;
 
     SPhoton() = default;
-    inline SPhoton(const Point& p, const Color& f,
-            Real theta, Real phi, const Shape* ptr)
-        : position{p}, flux{f}, lat{theta}, az{phi}, shape{ptr}
+    inline SPhoton(const Point& p, const Color& f, const Direction& d,
+            Index obj)
+        : position{p}, flux{f}, incoming{d}, object{std::uint16_t(obj)}
     {}
 
     struct KDTreeAccessor
@@ -82,8 +117,23 @@ struct SPhoton
     };
 };
 
+static_assert(sizeof(Photon) <= 20 && sizeof(SPhoton) <= 20);
+
+// Diffuse hits of light paths that are saved as photons
+enum class PhotonHits
+{
+    all,        // Every one
+    caustics,   // The first one, after specular or refractive bounces (L S+ D)
+    nonCaustics // Every one but those
+};
+
+// Leaves of photons are distance tested at once, see test/benchmark_kdtree
+template <typename PhotonTy>
+using PhotonMap = nn::BucketKDTree<PhotonTy, 3, typename PhotonTy::KDTreeAccessor>;
+
+// Same queries, built for a fixed evaluation radius
 template <typename PhotonTy>
-using PhotonMap = nn::KDTree<PhotonTy, 3, typename PhotonTy::KDTreeAccessor>;
+using PhotonGrid = nn::HashGrid<PhotonTy, 3, typename PhotonTy::KDTreeAccessor>;
 
 class Renderer
 {
@@ -93,22 +143,69 @@ private:
     TaskQueue tasks;
     TaskDivider taskDivider;
 
+    // Casts light paths, from the environment too if `fromEnvironment`,
+    // until `totalPhotons` photons are saved at their `hits`, and adds
+    // `progress` to the bar as they are
+    template<typename PhotonTy>
+    std::vector<PhotonTy> castPhotons(const ObjectSet& objects,
+            Index totalPhotons, PhotonHits hits, bool nextEventEstimation,
+            bool fromEnvironment, TextProgressBar& progressBar, Real progress);
+
     template<typename PhotonTy>
     void renderSpecialized(const Camera& cam, Image& img, const ObjectSet& objects,
             Index ppp, Index totalPhotons, Real evalRadius, Index evalNumPhotons,
-            bool nextEventEstimation, bool russianRoulette);
+            bool nextEventEstimation, bool russianRoulette, bool hybrid,
+            bool hashGrid, Index causticPhotons, Real causticRadius,
+            Index causticEvalPhotons, Index gatherRays,
+            Index irradianceSpacing);
+
+    template<typename PhotonTy>
+    void renderProgressiveSpecialized(const Camera& cam, Image& img,
+            const ObjectSet& objects, Index photonsPerIteration,
+            Real initialRadius, bool nextEventEstimation, bool hashGrid,
+            Index iterations, Real seconds);
 public:
     static constexpr Index totalConcurrency = 0;
 
     Renderer(const Index numWorkers, const Index queueSize,
             const TaskDivider& divider);
 
+    // With `hybrid`, the map only keeps caustic photons and the rest of the
+    // light is path traced. With `hashGrid`, photons are looked up in a
+    // PhotonGrid instead of a PhotonMap. Unless `hybrid`, a positive
+    // `causticPhotons` keeps caustic photons in a map of their own, of that
+    // many photons read with `causticRadius` and `causticEvalPhotons`, and
+    // the other map keeps the rest. Unless `hybrid`, a positive `gatherRays`
+    // reads the light that diffuse hits of the camera get from other
+    // surfaces where that many rays from them hit, and their direct light
+    // with `nextEventEstimation`. Only a caustic map gives them the caustics
+    // of point lights, which those rays cannot find. Unless `hybrid`, a positive
+    // `irradianceSpacing` estimates the light of the map at one photon of
+    // every `irradianceSpacing`, and reads the nearest estimate instead.
     void render(const Camera& cam, Image& img, const ObjectSet& objects,
             Index ppp, Index totalPhotons, Real evalRadius,
             Index evalNumPhotons, bool nextEventEstimation,
-            bool onlyCountSameShapePhotons, bool russianRoulette);
+            bool onlyCountSameShapePhotons, bool russianRoulette,
+            bool hybrid = false, bool hashGrid = false,
+            Index causticPhotons = 0, Real causticRadius = 0,
+            Index causticEvalPhotons = 0, Index gatherRays = 0,
+            Index irradianceSpacing = 0);
+
+    // Stochastic progressive photon mapping: every iteration casts
+    // `photonsPerIteration` photons, reads them at the first diffuse hit of a
+    // new camera path per pixel, and discards them. Each pixel keeps the
+    // photons it has read in a radius that starts at `initialRadius` and
+    // shrinks with them. Runs `iterations` iterations, or until `seconds`
+    // have passed, whichever comes first (0 for no limit).
+    void renderProgressive(const Camera& cam, Image& img,
+            const ObjectSet& objects, Index photonsPerIteration,
+            Real initialRadius, bool nextEventEstimation,
+            bool onlyCountSameShapePhotons, bool hashGrid,
+            Index iterations, Real seconds);
     
     Index numThreads();
 };
 
 } //namespace PhotonMapping
+
+#include "inline/photon_mapping.ipp"
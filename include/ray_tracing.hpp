@@ -17,6 +17,11 @@ struct Ray
     inline Point hitPoint(Real t) const { return p + (d * t); }
 };
 
+// Most bounces of the paths of every integrator. Russian roulette alone would
+// never end the paths that total internal reflection traps inside a
+// refractive object.
+constexpr Index maxBounces = 256;
+
 class Camera
 {
 private:
@@ -33,10 +38,29 @@ public:
     Camera(const Camera& cam);
 
     Ray randomRay(Index i, Index j);
+
+    inline Point position() const { return o; }
+
+    // Width of the image at unit distance from the pinhole
+    inline Real spread() const { return 2 * norm(l) / norm(f); }
+
+    // Solid angle density of the directions of randomRay over the whole
+    // image, 0 outside of it. It is also the importance of the camera.
+    Real directionPdf(const Direction& d) const;
+
+    struct Projection
+    {
+        bool visible;
+        Index i, j;
+    };
+
+    // Pixel whose rays pass through `p`
+    Projection project(const Point& p) const;
 };
 
 
 class Object;
+class Shape;
 struct ObjectSet;
 
 struct Intersection
@@ -49,5 +73,52 @@ struct Intersection
 
 Intersection findIntersection(const ObjectSet& objSet, const Ray& ray);
 
+class PointLight;
+class DirectionalTree;
+
+// Direct light from a single point light, black if it is occluded.
+Color castShadowRay(const ObjectSet& objSet, const PointLight& light,
+        const Direction& normal, const Point& hit, const Color& kd);
+
+// Direct light from the point lights of the scene. Every light is evaluated
+// unless the set has a light tree, which picks some of them stochastically.
+// Each thread first tests the last object that blocked the light.
 Color castShadowRays(const ObjectSet& objSet, const Direction& normal,
-        const Point& hit, const Color& kd);
+        const Point& hit, const Color& kd, Randomizer& random);
+
+struct ShadowCacheStats
+{
+    Index tests; // shadow rays with a cached occluder
+    Index hits;  // ... blocked by it
+};
+
+// Occluder cache use of castShadowRays by the threads that have finished
+ShadowCacheStats shadowCacheStats();
+
+// Samples one area light and returns its direct light contribution, weighted
+// with the power heuristic against cosine sampling of the diffuse lobe, or
+// against its mixture with `guide` if the bounce is guided. Callers which do
+// not sample diffuse bounces that may hit the light ask for it `unweighted`.
+Color castAreaShadowRay(const ObjectSet& objSet, const Direction& normal,
+        const Point& hit, const Color& kd, Randomizer& random,
+        const DirectionalTree* guide = nullptr, bool unweighted = false);
+
+// Samples a direction of the environment of the set, if any, and returns its
+// direct light contribution, weighted like castAreaShadowRay
+Color castEnvironmentShadowRay(const ObjectSet& objSet, const Direction& normal,
+        const Point& hit, const Color& kd, Randomizer& random,
+        const DirectionalTree* guide = nullptr);
+
+// Light from the environment along `ray`, which missed the scene. If a
+// diffuse bounce sampled it with density `bsdfPdf`, it is weighted against
+// castEnvironmentShadowRay.
+Color environmentRadiance(const ObjectSet& objSet, const Ray& ray, Real bsdfPdf = 0);
+
+// Solid angle density with which castAreaShadowRay samples the point of
+// `shape` hit by `ray` at distance `t`.
+Real areaLightPdf(const ObjectSet& objSet, const Shape& shape, const Ray& ray, Real t);
+
+inline Real powerHeuristic(Real pdf, Real otherPdf)
+{
+    return (pdf * pdf) / (pdf * pdf + otherPdf * otherPdf);
+}
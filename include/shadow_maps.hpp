@@ -0,0 +1,41 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "light.hpp"
+
+#include <vector>
+
+struct ObjectSet;
+
+/* Cube depth maps of the point lights, for approximate shadows. Every face
+   of the cube around a light stores the distance to the closest surface
+   seen through each of its texels, ray cast once before rendering. A point
+   is lit if it is not farther from the light than the depth of its texel,
+   up to a bias that grows with the size of the texel and the slope of the
+   surface, which hides most self-shadowing at the cost of thin shadows. */
+
+class ShadowMaps
+{
+private:
+    std::vector<Point> positions; // of the lights
+    std::vector<Real> depths; // 6 faces of resolution² texels per light
+    Index resolution = 0;
+
+    // Texel of the cube around a light crossed by direction `d` from it
+    Index texel(const Direction& d) const;
+
+public:
+    ShadowMaps() = default;
+
+    // Faces of `faceResolution` x `faceResolution` texels
+    ShadowMaps(const ObjectSet& objSet, Index faceResolution);
+
+    inline bool empty() const { return positions.empty(); }
+
+    // Bytes taken by the depths
+    inline Index memory() const { return depths.size() * sizeof(Real); }
+
+    // Whether light `light` reaches `p`, a surface point whose normal makes
+    // an angle of cosine `cosine` with the direction to the light
+    bool visible(Index light, const Point& p, Real cosine) const;
+};
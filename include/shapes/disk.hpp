@@ -9,6 +9,9 @@ protected:
 public:
     DiskBorder (Real radius) : r{radius} {}
     inline bool isInside(const Point p, const LimitedPlane<DiskBorder>& plane) const;
+
+    inline Real area() const;
+    inline Shape::Sample sample(const LimitedPlane<DiskBorder>& plane, Randomizer& random) const;
 };
 
 CHECK_BORDER_CONCEPT(DiskBorder)
@@ -18,6 +21,16 @@ class Disk : public LimitedPlane<DiskBorder>
 public:
     Disk(Direction normal, Point center, Real radius, bool solid)
         : LimitedPlane{center, normal, DiskBorder{radius}, solid} {}
+
+    // Non-solid disks are holes in an infinite plane
+    virtual bool isBounded() const override { return isSolid; }
+
+    virtual Real area() const override { return border.area(); }
+
+    virtual Sample sample(Randomizer& random) const override
+    {
+        return border.sample(*this, random);
+    }
 };
 
-#include "shapes/disk.ipp"
\ No newline at end of file
+#include "shapes/disk.ipp"
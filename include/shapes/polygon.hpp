@@ -13,8 +13,12 @@ class PolygonBorder
 {
 protected:  
     std::vector<Point> vertices;
+    std::vector<Real> fanAreas; // accumulated area of the triangle fan from vertex 0
 public:
     inline bool isInside(const Point p, const LimitedPlane<PolygonBorder>& plane) const;
+
+    inline Real area() const;
+    inline Shape::Sample sample(const LimitedPlane<PolygonBorder>& plane, Randomizer& random) const;
     friend class Polygon;
 };
 
@@ -27,6 +31,16 @@ class Polygon : public LimitedPlane<PolygonBorder>
 public:
     inline Polygon(Direction normal, Point origin, Point reference,
             const std::vector<FlatPoint>& points, bool solid);
+
+    // Non-solid polygons are holes in an infinite plane
+    virtual bool isBounded() const override { return isSolid; }
+
+    virtual Real area() const override { return border.area(); }
+
+    virtual Sample sample(Randomizer& random) const override
+    {
+        return border.sample(*this, random);
+    }
 };
 
-#include "shapes/polygon.ipp"
\ No newline at end of file
+#include "shapes/polygon.ipp"
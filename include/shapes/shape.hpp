@@ -18,4 +18,18 @@ public:
     };
 
     virtual Normal normal(const Direction d, const Point hit) const = 0;
-};
\ No newline at end of file
+
+    struct Sample
+    {
+        Point point;
+        Direction normal;
+    };
+
+    // Only bounded shapes have a finite area and can be sampled.
+    virtual bool isBounded() const { return false; }
+
+    virtual Real area() const { return 0; }
+
+    // Uniformly distributed point over the surface (pdf = 1 / area).
+    virtual Sample sample(Randomizer&) const { return {}; }
+};
@@ -14,4 +14,10 @@ public:
     virtual Real intersect(const Ray& ray) const override;
 
     virtual Normal normal(const Direction d, const Point hit) const override;
+
+    virtual bool isBounded() const override { return true; }
+
+    virtual Real area() const override { return 4 * numbers::pi * r * r; }
+
+    virtual Sample sample(Randomizer& random) const override;
 };
@@ -0,0 +1,206 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <thread>
+#include <type_traits>
+
+#include "scan.hpp"
+
+namespace nn {
+
+/**
+ * KD Tree with the queries of KDTree that do not allocate, laid out for large sets of elements.
+ * T - Data type contained in the KD Tree
+ * N - Number of dimensions of the KD Tree
+ * A - Axis function to the position, as in KDTree
+ * L - Maximum number of elements in a leaf
+ *
+ * Elements are kept in leaves of up to L elements instead of one per node, and their positions are also stored as a
+ * structure of arrays, so that leaves are distance tested 8 elements at a time (with AVX2 if available). Nodes take
+ * 8 bytes, with the split axis packed with the index of their right child, and are stored in depth first order: the
+ * left child follows its parent, and the elements of every subtree are contiguous.
+ * The top subtrees are built in parallel, and the tree is the same for any number of threads.
+ * Up to 2^(32 - bit_width(N)) elements (2^30 for 3 dimensions).
+**/
+template<typename T, std::size_t N, typename A, std::size_t L = 32>
+class BucketKDTree {
+public:
+    using real = std::decay_t<decltype(std::declval<A>()(std::declval<T>(),std::size_t(0)))>;
+    static constexpr std::size_t dimensions = N;
+    static constexpr std::size_t leaf_size = L;
+
+    using neighbor = nn::neighbor<T,real>;
+
+private:
+    static constexpr std::uint32_t axis_bits = std::bit_width(N);
+    static constexpr std::uint32_t leaf_axis = N; //The axis of leaves
+
+    struct node
+    {
+        union {
+            real split;          //Internal nodes: position of the splitting plane
+            std::uint32_t count; //Leaves: number of elements
+        };
+        std::uint32_t packed;    //Axis in the lower bits, right child (internal nodes) or first element (leaves) in the rest
+
+        std::size_t axis() const { return packed & ((1u << axis_bits) - 1); }
+        std::size_t index() const { return packed >> axis_bits; }
+    };
+
+    A axis_position;
+    std::vector<node> nodes;
+    std::vector<T> elements;
+    coordinate_arrays<real,N> coordinates;
+
+    template<typename P>
+    std::array<real,N> to_array(const P& p) const
+    {
+        std::array<real,N> a;
+        for (std::size_t i = 0; i < N; ++i)
+            a[i] = p[i];
+        return a;
+    }
+
+    //Nodes of a subtree of n elements, which only depends on n as elements are split in halves
+    static std::size_t subtree_nodes(std::size_t n)
+    {
+        return n <= L ? 1 : 1 + subtree_nodes(n / 2) + subtree_nodes(n - n / 2);
+    }
+
+    //Builds the subtree of the elements [left, right) from node current. Its two children are built in parallel for the
+    //first parallel_levels levels. Returns the node that follows the subtree.
+    std::size_t build_tree(std::size_t left, std::size_t right, std::size_t current, std::size_t parallel_levels)
+    {
+        if ((right-left) <= L)
+        {
+            nodes[current].count = right - left;
+            nodes[current].packed = (left << axis_bits) | leaf_axis;
+            return current + 1;
+        }
+
+        //The bounding box is built for each subtree, as the split planes leave loose boxes around elements on surfaces
+        std::array<real,N> bbmin, bbmax;
+        for (std::size_t i = 0; i < N; ++i)
+            bbmin[i] = bbmax[i] = axis_position(elements[left], i);
+        for (std::size_t e = left + 1; e < right; ++e)
+            for (std::size_t i = 0; i < N; ++i)
+            {
+                bbmin[i] = std::min(bbmin[i], axis_position(elements[e], i));
+                bbmax[i] = std::max(bbmax[i], axis_position(elements[e], i));
+            }
+
+        //We split the larger axis at the median
+        std::size_t axis = 0;
+        for (std::size_t i = 1; i < N; ++i)
+            if ((bbmax[i] - bbmin[i]) > (bbmax[axis] - bbmin[axis]))
+                axis = i;
+
+        std::size_t median = (right+left)/2;
+        std::nth_element(elements.begin() + left, elements.begin() + median, elements.begin() + right,
+            [&] (const T& a, const T& b)
+            {
+                return axis_position(a,axis) < axis_position(b,axis);
+            });
+
+        //To the left are smaller or equal than the split and to the right greater or equal
+        const real split = axis_position(elements[median], axis);
+
+        std::size_t right_child, end;
+        if (parallel_levels > 0)
+        {
+            right_child = current + 1 + subtree_nodes(median - left);
+            std::thread left_builder([&] { build_tree(left, median, current + 1, parallel_levels - 1); });
+            end = build_tree(median, right, right_child, parallel_levels - 1);
+            left_builder.join();
+        }
+        else
+        {
+            right_child = build_tree(left, median, current + 1, 0);
+            end = build_tree(median, right, right_child, 0);
+        }
+
+        nodes[current].split = split;
+        nodes[current].packed = (right_child << axis_bits) | axis;
+        return end;
+    }
+
+    void build_tree(std::size_t threads)
+    {
+        //Subtrees smaller than this are not worth a thread
+        constexpr std::size_t min_parallel_elements = 1 << 16;
+
+        std::size_t parallel_levels = threads > 1 ? std::bit_width(threads - 1) : 0;
+        while (parallel_levels > 0 && (elements.size() >> parallel_levels) < min_parallel_elements)
+            parallel_levels--;
+
+        nodes.assign(subtree_nodes(elements.size()), node{});
+        build_tree(0, elements.size(), 0, parallel_levels);
+
+        coordinates.assign(elements, axis_position);
+    }
+
+    //First the child on the side of p, then the other one if the splitting plane is closer than max_distance2
+    template<typename F>
+    void traverse(std::size_t current, const std::array<real,N>& p, const real& max_distance2, F& found) const
+    {
+        const node& n = nodes[current];
+        if (n.axis() == leaf_axis)
+        {
+            coordinates.scan(elements, n.index(), n.count, p, max_distance2, found);
+            return;
+        }
+
+        const real delta = p[n.axis()] - n.split;
+        const std::size_t near = delta < 0 ? current + 1 : n.index();
+        const std::size_t far = delta < 0 ? n.index() : current + 1;
+        traverse(near, p, max_distance2, found);
+        if (delta * delta < max_distance2)
+            traverse(far, p, max_distance2, found);
+    }
+
+public:
+    //Built with up to threads threads
+    BucketKDTree(std::vector<T>&& elements, const A& axis_position = A(), std::size_t threads = 1)
+        : axis_position(axis_position), elements(std::move(elements))
+    { build_tree(threads); }
+
+    BucketKDTree() = default;
+
+    template<typename C> //Constructing from a general collection if possible
+    requires std::is_same<T,typename C::value_type>::value
+    BucketKDTree(const C& c, const A& axis_position = A(), std::size_t threads = 1)
+        : axis_position(axis_position), elements(c.begin(),c.end())
+    { build_tree(threads); }
+
+    std::size_t size() const { return elements.size(); }
+
+    //Calls visit(element, squared_distance) for every element closer than max_distance to p, in no particular order and without allocating
+    template<typename P, typename F>
+    void for_each_in_radius(const P& p, float max_distance, F&& visit) const
+    {
+        if (elements.empty())
+            return;
+        const real max_distance2 = real(max_distance) * max_distance;
+        traverse(0, to_array(p), max_distance2, visit);
+    }
+
+    //The values.size() nearest neighbors closer than max_distance to p are stored in values, which is a max heap on the distance if it fills up.
+    //Returns how many were found. Does not allocate, so values can be reused between queries.
+    template<typename P>
+    std::size_t nearest_neighbors(const P& p, std::span<neighbor> values, float max_distance) const
+    {
+        real max_distance2 = real(max_distance) * max_distance;
+        if (values.empty() || elements.empty())
+            return 0;
+
+        nearest_set<T,real> nearest(values, max_distance2);
+        traverse(0, to_array(p), max_distance2, nearest);
+        return nearest.size();
+    }
+};
+
+}; // namespace nn
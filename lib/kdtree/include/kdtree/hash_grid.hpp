@@ -0,0 +1,193 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+#include "scan.hpp"
+
+namespace nn {
+
+/**
+ * Uniform grid with the queries of BucketKDTree, for queries of a radius known when it is built.
+ * T - Data type contained in the grid
+ * N - Number of dimensions of the grid
+ * A - Axis function to the position, as in KDTree
+ *
+ * Cells are twice as wide as the radius, so the elements within the radius of a point are in the 2^N cells around it
+ * (8 in 3 dimensions). Cells are hashed into a table of about as many entries as elements, and elements are sorted by
+ * the hash of their cell with a counting sort, so every entry is a contiguous run of elements, whose positions are also
+ * stored as a structure of arrays and scanned linearly. Larger radii are supported, but scan more cells.
+**/
+template<typename T, std::size_t N, typename A>
+class HashGrid {
+public:
+    using real = std::decay_t<decltype(std::declval<A>()(std::declval<T>(),std::size_t(0)))>;
+    static constexpr std::size_t dimensions = N;
+    using neighbor = nn::neighbor<T,real>;
+
+private:
+    using cell = std::array<std::int64_t,N>;
+
+    A axis_position;
+    real cell_size = 1, inverse_cell_size = 1;
+    std::size_t hash_mask = 0;
+    std::vector<T> elements;          //Sorted by the hash of their cell
+    std::vector<std::uint32_t> start; //Elements with hash h are [start[h], start[h + 1])
+    coordinate_arrays<real,N> coordinates;
+
+    template<typename P>
+    std::array<real,N> to_array(const P& p) const
+    {
+        std::array<real,N> a;
+        for (std::size_t i = 0; i < N; ++i)
+            a[i] = p[i];
+        return a;
+    }
+
+    std::int64_t cell_coordinate(real x) const
+    {
+        return std::int64_t(std::floor(x * inverse_cell_size));
+    }
+
+    std::size_t hash(const cell& c) const
+    {
+        //Large primes per axis [Teschner et al. 2003]
+        constexpr std::array<std::uint64_t,4> primes {73856093, 19349663, 83492791, 2654435761};
+        std::uint64_t h = 0;
+        for (std::size_t i = 0; i < N; ++i)
+            h ^= std::uint64_t(c[i]) * primes[i % primes.size()];
+        return h & hash_mask;
+    }
+
+    std::size_t hash_of(const T& t) const
+    {
+        cell c;
+        for (std::size_t i = 0; i < N; ++i)
+            c[i] = cell_coordinate(axis_position(t, i));
+        return hash(c);
+    }
+
+    void build_grid(real radius)
+    {
+        cell_size = 2 * radius;
+        inverse_cell_size = 1 / cell_size;
+        const std::size_t entries = std::bit_ceil(std::max<std::size_t>(elements.size(), 1));
+        hash_mask = entries - 1;
+
+        //Counting sort on the hash, which takes as many values as entries
+        std::vector<std::uint32_t> hashes(elements.size());
+        start.assign(entries + 1, 0);
+        for (std::size_t e = 0; e < elements.size(); ++e)
+        {
+            hashes[e] = hash_of(elements[e]);
+            start[hashes[e] + 1]++;
+        }
+        for (std::size_t h = 0; h < entries; ++h)
+            start[h + 1] += start[h];
+
+        std::vector<std::uint32_t> next(start.begin(), start.end() - 1);
+        std::vector<T> sorted(elements.size());
+        for (std::size_t e = 0; e < elements.size(); ++e)
+            sorted[next[hashes[e]]++] = std::move(elements[e]);
+        elements = std::move(sorted);
+
+        coordinates.assign(elements, axis_position);
+    }
+
+    //Scans the entries of the cells around p within max_distance2, found as in coordinate_arrays::scan
+    template<typename F>
+    void scan_cells(const std::array<real,N>& p, real max_distance, const real& max_distance2, F& found) const
+    {
+        cell low, high;
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            low[i] = cell_coordinate(p[i] - max_distance);
+            high[i] = cell_coordinate(p[i] + max_distance);
+        }
+
+        //Different cells may share an entry, which is only scanned once
+        std::array<std::size_t,std::size_t(1) << N> around;
+        std::vector<std::size_t> many;
+        std::size_t scanned = 0;
+
+        cell c = low;
+        for (;;)
+        {
+            const std::size_t h = hash(c);
+            const bool overflow = scanned >= around.size(); //Only with radii larger than the one of the grid
+            if (overflow && many.empty())
+                many.assign(around.begin(), around.end());
+            const bool repeated = overflow
+                    ? std::find(many.begin(), many.end(), h) != many.end()
+                    : std::find(around.begin(), around.begin() + scanned, h) != around.begin() + scanned;
+            if (!repeated)
+            {
+                if (overflow)
+                    many.push_back(h);
+                else
+                    around[scanned] = h;
+                scanned++;
+                coordinates.scan(elements, start[h], start[h + 1] - start[h], p, max_distance2, found);
+            }
+
+            //Next cell of the box
+            std::size_t i = 0;
+            while (i < N && c[i] == high[i])
+            {
+                c[i] = low[i];
+                ++i;
+            }
+            if (i == N)
+                break;
+            ++c[i];
+        }
+    }
+
+public:
+    //Cells are 2 * radius wide, so queries within radius scan 2^N cells
+    HashGrid(std::vector<T>&& elements, real radius, const A& axis_position = A())
+        : axis_position(axis_position), elements(std::move(elements))
+    { build_grid(radius); }
+
+    HashGrid() = default;
+
+    template<typename C> //Constructing from a general collection if possible
+    requires std::is_same<T,typename C::value_type>::value
+    HashGrid(const C& c, real radius, const A& axis_position = A())
+        : axis_position(axis_position), elements(c.begin(),c.end())
+    { build_grid(radius); }
+
+    std::size_t size() const { return elements.size(); }
+
+    //Calls visit(element, squared_distance) for every element closer than max_distance to p, in no particular order and without allocating
+    //if max_distance is within the radius of the grid
+    template<typename P, typename F>
+    void for_each_in_radius(const P& p, float max_distance, F&& visit) const
+    {
+        if (elements.empty())
+            return;
+        const real max_distance2 = real(max_distance) * max_distance;
+        scan_cells(to_array(p), max_distance, max_distance2, visit);
+    }
+
+    //The values.size() nearest neighbors closer than max_distance to p are stored in values, which is a max heap on the distance if it fills up.
+    //Returns how many were found. Does not allocate if max_distance is within the radius of the grid.
+    template<typename P>
+    std::size_t nearest_neighbors(const P& p, std::span<neighbor> values, float max_distance) const
+    {
+        real max_distance2 = real(max_distance) * max_distance;
+        if (values.empty() || elements.empty())
+            return 0;
+
+        nearest_set<T,real> nearest(values, max_distance2);
+        scan_cells(to_array(p), max_distance, max_distance2, nearest);
+        return nearest.size();
+    }
+};
+
+}; // namespace nn
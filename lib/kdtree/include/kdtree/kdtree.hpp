@@ -3,6 +3,7 @@
 #include <array>
 #include <algorithm>
 #include <cmath>
+#include <span>
 
 namespace nn {
 
@@ -149,6 +150,26 @@ private:
         }
     }
     
+    template<typename P>
+    std::array<real,N> to_array(const P& p) const
+    {
+        std::array<real,N> a;
+        for (std::size_t i = 0; i < N; ++i)
+            a[i] = p[i];
+        return a;
+    }
+
+    real squared_distance(const std::array<real,N>& p, const T& t) const
+    {
+        real s(0);
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            const real d = p[i] - axis_position(t, i);
+            s += d * d;
+        }
+        return s;
+    }
+
     void build_tree()
     {
         nodes.resize(elements.size());
@@ -190,6 +211,76 @@ private:
         }
     }     
     
+    template<typename F>
+    void for_each_in_radius_impl(std::size_t left, std::size_t right, const std::array<real,N>& p, real max_distance2, F& visit) const {
+        if (right > left)
+        {
+            std::size_t median = (right+left)/2;
+            const real d2 = squared_distance(p, elements[median]);
+            if (d2 < max_distance2)
+                visit(elements[median], d2);
+            if ((right-left)>1) {
+                //Distance to the splitting plane, the other side is only explored if it is within the radius
+                const std::size_t axis = nodes[median];
+                const real delta = p[axis] - axis_position(elements[median], axis);
+                if (delta < 0) {
+                    for_each_in_radius_impl(left,median,p,max_distance2,visit);
+                    if (delta * delta < max_distance2)
+                        for_each_in_radius_impl(median+1,right,p,max_distance2,visit);
+                } else {
+                    for_each_in_radius_impl(median+1,right,p,max_distance2,visit);
+                    if (delta * delta < max_distance2)
+                        for_each_in_radius_impl(left,median,p,max_distance2,visit);
+                }
+            }
+        }
+    }
+
+public:
+    //Result of a query into caller provided storage
+    struct neighbor
+    {
+        const T* element;
+        real squared_distance;
+    };
+
+private:
+    void nearest_neighbors_impl(std::span<neighbor> values, std::size_t& found, std::size_t left, std::size_t right, const std::array<real,N>& p, real& max_distance2) const {
+        if (right > left)
+        {
+            std::size_t median = (right+left)/2;
+            auto distance_comparison = [] (const neighbor& a, const neighbor& b) { return a.squared_distance < b.squared_distance; };
+            const real d2 = squared_distance(p, elements[median]);
+            if (d2 < max_distance2) {
+                if (found < values.size()) {
+                    values[found++] = {&elements[median], d2};
+                    if (found == values.size()) { //We reach the number so we make this a heap
+                        std::make_heap(values.begin(),values.end(),distance_comparison);
+                        max_distance2 = values.front().squared_distance;
+                    }
+                } else { //The furthest one is replaced
+                    std::pop_heap(values.begin(),values.end(),distance_comparison);
+                    values.back() = {&elements[median], d2};
+                    std::push_heap(values.begin(),values.end(),distance_comparison);
+                    max_distance2 = values.front().squared_distance;
+                }
+            }
+            if ((right-left)>1) {
+                const std::size_t axis = nodes[median];
+                const real delta = p[axis] - axis_position(elements[median], axis);
+                if (delta < 0) {
+                    nearest_neighbors_impl(values,found,left,median,p,max_distance2);
+                    if (delta * delta < max_distance2)
+                        nearest_neighbors_impl(values,found,median+1,right,p,max_distance2);
+                } else {
+                    nearest_neighbors_impl(values,found,median+1,right,p,max_distance2);
+                    if (delta * delta < max_distance2)
+                        nearest_neighbors_impl(values,found,left,median,p,max_distance2);
+                }
+            }
+        }
+    }
+
 public:
     KDTree(std::vector<T>&& elements, const A& axis_position = A())
         : elements(std::move(elements)), axis_position(axis_position) 
@@ -247,6 +338,27 @@ public:
                 return std::sqrt(s);
             });            
     }
+
+    std::size_t size() const { return elements.size(); }
+
+    //Calls visit(element, squared_distance) for every element closer than max_distance to p, in no particular order and without allocating
+    template<typename P, typename F>
+    void for_each_in_radius(const P& p, float max_distance, F&& visit) const
+    {
+        for_each_in_radius_impl(0, elements.size(), to_array(p), real(max_distance) * max_distance, visit);
+    }
+
+    //The values.size() nearest neighbors closer than max_distance to p are stored in values, which is a max heap on the distance if it fills up.
+    //Returns how many were found. Does not allocate, so values can be reused between queries.
+    template<typename P>
+    std::size_t nearest_neighbors(const P& p, std::span<neighbor> values, float max_distance) const
+    {
+        std::size_t found = 0;
+        real max_distance2 = real(max_distance) * max_distance;
+        if (!values.empty())
+            nearest_neighbors_impl(values, found, 0, elements.size(), to_array(p), max_distance2);
+        return found;
+    }
 };
 
 template<std::size_t N,typename C,typename A>
@@ -0,0 +1,140 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <span>
+#include <type_traits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace nn {
+
+//Result of a query into caller provided storage
+template<typename T, typename real>
+struct neighbor
+{
+    const T* element;
+    real squared_distance;
+};
+
+/**
+ * Positions of a sequence of elements stored as a structure of arrays, so that runs of them are distance tested
+ * 8 elements at a time (with AVX2 if available).
+ * real - Type of the coordinates
+ * N - Number of dimensions
+**/
+template<typename real, std::size_t N>
+class coordinate_arrays {
+public:
+    static constexpr std::size_t lanes = 8; //Elements distance tested at once
+
+private:
+    std::array<std::vector<real>,N> coordinates; //Padded to read whole vectors past the last element
+
+    //Bit l is set if the element first + l is closer than max_distance2 to p, its squared distance is in d2[l]
+    unsigned closer(const std::array<real,N>& p, std::size_t first, real max_distance2, real* d2) const
+    {
+#ifdef __AVX2__
+        if constexpr (std::is_same_v<real,float>)
+        {
+            __m256 s = _mm256_setzero_ps();
+            for (std::size_t i = 0; i < N; ++i)
+            {
+                const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(&coordinates[i][first]), _mm256_set1_ps(p[i]));
+                s = _mm256_add_ps(s, _mm256_mul_ps(d, d));
+            }
+            _mm256_storeu_ps(d2, s);
+            return _mm256_movemask_ps(_mm256_cmp_ps(s, _mm256_set1_ps(max_distance2), _CMP_LT_OQ));
+        }
+#endif
+        unsigned mask = 0;
+        for (std::size_t l = 0; l < lanes; ++l)
+        {
+            real s(0);
+            for (std::size_t i = 0; i < N; ++i)
+            {
+                const real d = coordinates[i][first + l] - p[i];
+                s += d * d;
+            }
+            d2[l] = s;
+            mask |= unsigned(s < max_distance2) << l;
+        }
+        return mask;
+    }
+
+public:
+    //Positions of elements, in the same order
+    template<typename T, typename A>
+    void assign(const std::vector<T>& elements, const A& axis_position)
+    {
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            coordinates[i].assign(elements.size() + lanes, real(0));
+            for (std::size_t e = 0; e < elements.size(); ++e)
+                coordinates[i][e] = axis_position(elements[e], i);
+        }
+    }
+
+    //Calls found(element, squared_distance) for the elements [first, first + count) closer than max_distance2 to p.
+    //found may reduce max_distance2, but elements tested at once with it are passed anyway.
+    template<typename T, typename F>
+    void scan(const std::vector<T>& elements, std::size_t first, std::size_t count,
+            const std::array<real,N>& p, const real& max_distance2, F& found) const
+    {
+        for (std::size_t offset = 0; offset < count; offset += lanes)
+        {
+            std::array<real,lanes> d2;
+            unsigned mask = closer(p, first + offset, max_distance2, d2.data());
+            if (count - offset < lanes)
+                mask &= (1u << (count - offset)) - 1;
+            for (; mask != 0; mask &= mask - 1)
+            {
+                const std::size_t l = std::countr_zero(mask);
+                found(elements[first + offset + l], d2[l]);
+            }
+        }
+    }
+};
+
+//Keeps the values.size() nearest elements it is given in values, as a max heap on the distance once it fills up, and
+//reduces max_distance2 to the distance of the furthest of them then.
+template<typename T, typename real>
+class nearest_set {
+    std::span<neighbor<T,real>> values;
+    real& max_distance2;
+    std::size_t found = 0;
+
+    static bool distance_comparison(const neighbor<T,real>& a, const neighbor<T,real>& b)
+    {
+        return a.squared_distance < b.squared_distance;
+    }
+
+public:
+    nearest_set(std::span<neighbor<T,real>> values, real& max_distance2)
+        : values(values), max_distance2(max_distance2) {}
+
+    std::size_t size() const { return found; }
+
+    void operator()(const T& element, real d2)
+    {
+        if (d2 >= max_distance2) //It was tested before a closer element reduced the distance
+            return;
+        if (found < values.size()) {
+            values[found++] = {&element, d2};
+            if (found == values.size()) { //We reach the number so we make this a heap
+                std::make_heap(values.begin(),values.end(),distance_comparison);
+                max_distance2 = values.front().squared_distance;
+            }
+        } else { //The furthest one is replaced
+            std::pop_heap(values.begin(),values.end(),distance_comparison);
+            values.back() = {&element, d2};
+            std::push_heap(values.begin(),values.end(),distance_comparison);
+            max_distance2 = values.front().squared_distance;
+        }
+    }
+};
+
+}; // namespace nn
@@ -0,0 +1,428 @@
+#include "bidirectional_path_tracing.hpp"
+
+#include <cmath>
+
+using namespace BidirectionalPathTracing;
+
+BidirectionalPathTracing::Renderer::
+Renderer(const Index numWorkers, const Index queueSize,
+        const TaskDivider& divider, Index maxDepth)
+    : tasks{queueSize}, taskDivider{divider}, maxDepth{maxDepth}
+{
+    auto hw = std::thread::hardware_concurrency();
+    const Index nThreads = numWorkers <= 0
+            ? numbers::max(hw, (decltype(hw))1)
+            : numWorkers;
+
+    threadPool.resize(nThreads);
+}
+
+Index BidirectionalPathTracing::Renderer::
+numThreads()
+{
+    return threadPool.size();
+}
+
+namespace {
+
+void leaderRoutine(TaskQueue& tasks, TaskDivider& divider)
+{
+    Task task;
+    while (divider.getNextTask(task))
+    {
+        tasks.enqueue(task);
+    }
+    tasks.stop(); // Tell threads not to block if queue is empty, but to quit
+}
+
+struct Vertex
+{
+    enum class Type : uint8_t {camera, light, surface};
+
+    Type type;
+    Point p;
+    Direction n;        // normal of the surface at the incident side
+    Color beta;         // throughput of the subpath up to this vertex
+    const Material* material = nullptr;
+    bool delta = false; // the next step was sampled by a specular or refractive component
+    Real pdfFwd = 0;    // area density of sampling it from its subpath
+    Real pdfRev = 0;    // area density of sampling it from the other side
+};
+
+using Path = std::vector<Vertex>;
+
+// Whether paths can be connected at `v`, which needs a diffuse component.
+// Mixed materials are connectable whichever component their next step took.
+bool connectable(const Vertex& v)
+{
+    return v.type != Vertex::Type::surface || v.material->kd().luminance() > 0;
+}
+
+// Cosine of `d` with the surface at `v`, 1 for camera and light vertices
+Real cosine(const Vertex& v, const Direction& d)
+{
+    return v.type == Vertex::Type::surface ? std::abs(dot(v.n, d)) : 1;
+}
+
+// Area density at `to` of a direction from `from` with solid angle density `pdf`
+Real toArea(Real pdf, const Vertex& from, const Vertex& to)
+{
+    const Direction d = to.p - from.p;
+    const Real d2 = dot(d, d);
+    return pdf * cosine(to, d / std::sqrt(d2)) / d2;
+}
+
+// Area density at `to` of being sampled from `from`
+Real pdf(const Camera& cam, const Vertex& from, const Vertex& to)
+{
+    const Direction d = normalize(to.p - from.p);
+
+    Real pdfDir = 0;
+    switch (from.type)
+    {
+    case Vertex::Type::camera:
+        pdfDir = cam.directionPdf(d);
+        break;
+    case Vertex::Type::light:
+        pdfDir = 1 / (4 * numbers::pi); // point lights emit uniformly
+        break;
+    case Vertex::Type::surface:
+        pdfDir = from.material->diffusePdf(from.n, d);
+        break;
+    }
+
+    return toArea(pdfDir, from, to);
+}
+
+// Diffuse BRDF at surface vertex `v` between the directions to `a` and `b`.
+// Diffuse components only reflect light on the incident side.
+Color brdf(const Vertex& v, const Point& a, const Point& b)
+{
+    if (dot(v.n, a - v.p) <= 0 || dot(v.n, b - v.p) <= 0)
+        return {};
+    return v.material->kd() / numbers::pi;
+}
+
+bool visible(const ObjectSet& objSet, const Point& a, const Point& b)
+{
+    const Direction d = b - a;
+    const Real distance = norm(d);
+    const Direction dN = d / distance; // normalized d
+
+    const Ray shadowRay {a + dN * 0.0001, dN};
+    for (const Object& obj : objSet.objects)
+    {
+        const auto its = obj.shape().intersect(shadowRay);
+        if (Ray::isHit(its) && its < distance * 0.999)
+            return false;
+    }
+    return true;
+}
+
+/* Extends `path` from its last vertex through `ray`, sampled with solid angle
+   density `pdfDir` (0 if it is a delta direction) and reaching the first
+   hit with throughput `beta`. Emission found by camera subpaths is added to
+   `emitted`, as it can only be sampled this way. */
+void randomWalk(const ObjectSet& objSet, Ray ray, Color beta, Real pdfDir,
+        Path& path, Index maxVertices, Randomizer& random, Color* emitted)
+{
+    while (path.size() < maxVertices)
+    {
+        const auto [t, hitObj] = findIntersection(objSet, ray);
+        if (!Ray::isHit(t))
+            return;
+
+        const auto& material = hitObj->material();
+        const auto [emits, emission] = material.emission();
+        if (emits)
+        {
+            if (emitted)
+                *emitted = *emitted + beta * emission;
+            return;
+        }
+
+        const Point hit = ray.hitPoint(t);
+        const auto normal = hitObj->shape().normal(ray.d, hit);
+
+        Vertex vertex {Vertex::Type::surface, hit, normal.normal, beta, &material};
+        vertex.pdfFwd = toArea(pdfDir, path.back(), vertex);
+        path.push_back(vertex);
+
+        Ray next;
+        const auto [color, k] = material.eval(hit, ray, next, normal, random);
+        if (k == Material::Component::ka)
+            return;
+
+        Vertex& current = path.back();
+        Vertex& previous = path[path.size() - 2];
+        if (k == Material::Component::kd)
+        {
+            pdfDir = material.diffusePdf(normal.normal, next.d);
+            previous.pdfRev = toArea(material.diffusePdf(normal.normal, -1 * ray.d),
+                    current, previous);
+        }
+        else
+        {
+            current.delta = true;
+            pdfDir = 0;
+            previous.pdfRev = 0;
+        }
+
+        beta = beta * color;
+        ray = next;
+    }
+}
+
+void cameraSubpath(const ObjectSet& objSet, Camera& cam, Index i, Index j,
+        Path& path, Index maxVertices, Randomizer& random, Color& emitted)
+{
+    path.clear();
+
+    Vertex camera {Vertex::Type::camera, cam.position(), {}, Color{1, 1, 1}};
+    path.push_back(camera);
+
+    const Ray ray = cam.randomRay(i, j);
+    randomWalk(objSet, ray, camera.beta, cam.directionPdf(ray.d),
+            path, maxVertices, random, &emitted);
+}
+
+void lightSubpath(const ObjectSet& objSet, Path& path, Index maxVertices,
+        Randomizer& random)
+{
+    path.clear();
+
+    const Index numLights = objSet.pointLights.size();
+    if (numLights == 0)
+        return;
+
+    const Index chosen = numbers::min(Index(random() * numLights), numLights - 1);
+    const PointLight& light = objSet.pointLights[chosen];
+    const Real pdfChoice = Real(1) / numLights;
+
+    Vertex origin {Vertex::Type::light, light.position(), {}, light.color() / pdfChoice};
+    origin.pdfFwd = pdfChoice;
+    path.push_back(origin);
+
+    const Real cosLat = 2 * random() - 1;
+    const Real sinLat = std::sqrt(numbers::max(Real(0), 1 - cosLat * cosLat));
+    const Real az = 2 * numbers::pi * random();
+    const Direction dir {sinLat * std::sin(az), cosLat, sinLat * std::cos(az)};
+
+    const Real pdfDir = 1 / (4 * numbers::pi);
+    randomWalk(objSet, Ray{light.position(), dir}, origin.beta / pdfDir, pdfDir,
+            path, maxVertices, random, nullptr);
+}
+
+/* Power heuristic weight of the path made of the first `s` vertices of the
+   light subpath and the first `t` of the camera subpath. Densities of the
+   other strategies are found as ratios of the forward and reverse densities
+   of each vertex, after updating those affected by the connection. The steps
+   out of `qs` and `pt` are the connection, which is never a delta step. */
+Real misWeight(const Camera& cam, Path& lightPath, Path& cameraPath,
+        Index s, Index t)
+{
+    Vertex& qs = lightPath[s - 1];
+    Vertex& pt = cameraPath[t - 1];
+    Vertex* qsMinus = s > 1 ? &lightPath[s - 2] : nullptr;
+    Vertex* ptMinus = t > 1 ? &cameraPath[t - 2] : nullptr;
+
+    const Real saved[] = {qs.pdfRev, pt.pdfRev,
+                          qsMinus ? qsMinus->pdfRev : 0,
+                          ptMinus ? ptMinus->pdfRev : 0};
+    const bool savedDelta[] = {qs.delta, pt.delta};
+    qs.delta = false;
+    pt.delta = false;
+
+    pt.pdfRev = pdf(cam, qs, pt);
+    qs.pdfRev = pdf(cam, pt, qs);
+    if (qsMinus)
+        qsMinus->pdfRev = pdf(cam, qs, *qsMinus);
+    if (ptMinus)
+        ptMinus->pdfRev = pdf(cam, pt, *ptMinus);
+
+    auto remap0 = [](Real x) { return x != 0 ? x : 1; };
+
+    Real sum = 0;
+    Real ratio = 1;
+    for (Index i = t - 1; i > 0; i--)
+    {
+        ratio *= remap0(cameraPath[i].pdfRev) / remap0(cameraPath[i].pdfFwd);
+        if (connectable(cameraPath[i]) && !cameraPath[i].delta && !cameraPath[i - 1].delta)
+            sum += ratio * ratio;
+    }
+
+    ratio = 1;
+    for (Index i = s; i-- > 0;)
+    {
+        ratio *= remap0(lightPath[i].pdfRev) / remap0(lightPath[i].pdfFwd);
+        // Point lights can not be hit by camera subpaths
+        const bool deltaPrevious = i > 0 ? lightPath[i - 1].delta : true;
+        if (connectable(lightPath[i]) && !lightPath[i].delta && !deltaPrevious)
+            sum += ratio * ratio;
+    }
+
+    qs.pdfRev = saved[0];
+    pt.pdfRev = saved[1];
+    qs.delta = savedDelta[0];
+    pt.delta = savedDelta[1];
+    if (qsMinus)
+        qsMinus->pdfRev = saved[2];
+    if (ptMinus)
+        ptMinus->pdfRev = saved[3];
+
+    return 1 / (1 + sum);
+}
+
+// Contribution of connecting vertex `s` of the light subpath with vertex `t`
+// of the camera subpath (t >= 2). Light tracing (t = 1) is done apart.
+Color connect(const ObjectSet& objSet, const Camera& cam,
+        Path& lightPath, Path& cameraPath, Index s, Index t)
+{
+    const Vertex& qs = lightPath[s - 1];
+    const Vertex& pt = cameraPath[t - 1];
+    if (!connectable(pt) || !connectable(qs))
+        return {};
+
+    const Direction d = qs.p - pt.p;
+    const Real d2 = dot(d, d);
+    const Direction dN = d / std::sqrt(d2);
+
+    const Color fs = s == 1 ? Color{1, 1, 1} : brdf(qs, lightPath[s - 2].p, pt.p);
+    const Color ft = brdf(pt, cameraPath[t - 2].p, qs.p);
+    const Color contribution = qs.beta * fs * pt.beta * ft
+                             * (cosine(qs, dN) * cosine(pt, dN) / d2);
+
+    if (contribution.luminance() <= 0 || !visible(objSet, pt.p, qs.p))
+        return {};
+
+    return contribution * misWeight(cam, lightPath, cameraPath, s, t);
+}
+
+// Connects vertex `s` of the light subpath to the camera, splatting its
+// contribution into `film`.
+void splat(const ObjectSet& objSet, const Camera& cam, Path& lightPath,
+        Path& cameraPath, Index s, std::vector<Color>& film, Index width)
+{
+    const Vertex& qs = lightPath[s - 1];
+    const Vertex& camera = cameraPath[0];
+    if (!connectable(qs))
+        return;
+
+    const Direction d = qs.p - camera.p;
+    const Real d2 = dot(d, d);
+    const Direction dN = d / std::sqrt(d2);
+
+    const auto [inside, i, j] = cam.project(qs.p);
+    if (!inside)
+        return;
+
+    const Real importance = cam.directionPdf(dN);
+    const Color contribution = qs.beta * brdf(qs, lightPath[s - 2].p, camera.p)
+                             * (importance * cosine(qs, dN) / d2);
+
+    if (contribution.luminance() <= 0 || !visible(objSet, qs.p, camera.p))
+        return;
+
+    film[i * width + j] = film[i * width + j]
+            + contribution * misWeight(cam, lightPath, cameraPath, s, 1);
+}
+
+void workerRoutine(TaskQueue& tasks, Real increment, const Camera& camera,
+        std::vector<Color>& cameraFilm, std::vector<Color>& lightFilm,
+        Index width, const ObjectSet& objects, Index ppp, Index maxDepth,
+        TextProgressBar& progressBar)
+{
+    // Each thread has its own unique camera, to avoid critical section
+    // at generating random numbers.
+    Camera cam {camera};
+    Randomizer random {0.0, 1.0};
+    Task task {};
+
+    // Both subpaths may be complete paths of `maxDepth` bounces
+    const Index maxVertices = maxDepth + 1;
+    Path cameraPath, lightPath;
+    cameraPath.reserve(maxVertices);
+    lightPath.reserve(maxVertices);
+
+    while (tasks.dequeue(task))
+    {
+        for (Index i : numbers::range(task.start.i, task.end.i)) //for i = start.i .. end.i
+        for (Index j : numbers::range(task.start.j, task.end.j))
+        {
+            Color meanColor {0, 0, 0};
+            for ([[maybe_unused]] Index k : numbers::range(0, ppp))
+            {
+                cameraSubpath(objects, cam, i, j, cameraPath, maxVertices, random, meanColor);
+                lightSubpath(objects, lightPath, maxVertices, random);
+
+                for (Index s : numbers::range(1, lightPath.size() + 1))
+                {
+                    // Paths of s + t vertices have s + t - 2 bounces
+                    if (s >= 2)
+                        splat(objects, cam, lightPath, cameraPath, s, lightFilm, width);
+
+                    for (Index t : numbers::range(2, cameraPath.size() + 1))
+                    {
+                        if (s + t - 2 > maxDepth)
+                            break;
+                        meanColor = meanColor + connect(objects, cam, lightPath, cameraPath, s, t);
+                    }
+                }
+            }
+            // Thread-safe operation: a pixel is not assigned to two different threads
+            cameraFilm[i * width + j] = meanColor / ppp;
+        }
+        progressBar.incrementProgress(increment);
+    }
+}
+
+} //namespace
+
+void BidirectionalPathTracing::Renderer::
+render(const Camera& cam, Image& img,
+        const ObjectSet& objects, Index ppp)
+{
+    std::cout << "Algorithm: bidirectional path tracing\n";
+    std::cout << "Worker pool size: " << numThreads() << "\n\n";
+
+    const Real totalSize = taskDivider.width * taskDivider.height;
+    const Real regionSize = taskDivider.regionWidth * taskDivider.regionHeight;
+    const Real increment = regionSize / totalSize;
+
+    const Index width = taskDivider.width;
+    const Index pixels = img.pixels();
+    std::vector<Color> cameraFilm(pixels);
+    std::vector<std::vector<Color>> lightFilms(threadPool.size(), std::vector<Color>(pixels));
+
+    TextProgressBar progressBar {std::cout};
+
+    leader = std::thread(leaderRoutine,
+            std::ref(tasks), std::ref(taskDivider));
+    for (Index w : numbers::range(0, threadPool.size()))
+    {
+        threadPool[w] = std::thread(workerRoutine, std::ref(tasks), increment,
+                std::ref(cam), std::ref(cameraFilm), std::ref(lightFilms[w]), width,
+                std::ref(objects), ppp, maxDepth, std::ref(progressBar));
+    }
+
+    std::cout << "Rendering...\n";
+    progressBar.launch(true);
+
+    leader.join();
+    for (auto& worker : threadPool)
+        worker.join();
+
+    progressBar.stop();
+    progressBar.join();
+
+    // One light subpath was traced per camera sample
+    for (Index p : numbers::range(0, pixels))
+    {
+        Color color = cameraFilm[p];
+        for (const auto& film : lightFilms)
+            color = color + film[p] / ppp;
+        img(p) = RGBPixel (color);
+    }
+
+    img.updateLuminance();
+}
@@ -0,0 +1,159 @@
+#include "environment.hpp"
+#include "image.hpp"
+#include "image_reader.hpp"
+
+AliasTable::AliasTable(const std::vector<Real>& weights)
+    : bins(weights.size()), probabilities(weights.size())
+{
+    const Index n = weights.size();
+
+    double sum = 0;
+    for (Real w : weights)
+        sum += w;
+    if (sum <= 0)
+    {
+        bins.clear();
+        probabilities.clear();
+        return;
+    }
+
+    // Bins under and over the mean weight, pairs of both fill a bin each
+    std::vector<Index> small, large;
+    std::vector<double> scaled(n);
+    for (Index i : numbers::range(0, n))
+    {
+        probabilities[i] = weights[i] / sum;
+        scaled[i] = weights[i] / sum * n;
+        (scaled[i] < 1 ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+        const Index s = small.back(), l = large.back();
+        small.pop_back();
+
+        bins[s] = {Real(scaled[s]), l};
+        scaled[l] -= 1 - scaled[s];
+        if (scaled[l] < 1)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Only rounding errors are left
+    for (Index i : large)
+        bins[i] = {1, i};
+    for (Index i : small)
+        bins[i] = {1, i};
+}
+
+Index AliasTable::sample(Randomizer& random) const
+{
+    const Real u = random() * bins.size();
+    const Index i = numbers::min(Index(u), bins.size() - 1);
+    return (u - i) < bins[i].probability ? i : bins[i].alias;
+}
+
+namespace {
+
+// Solid angle covered by the pixels of row `i` out of `height`, each of
+// them out of `width`
+Real pixelSolidAngle(Index i, Index width, Index height)
+{
+    const Real cos0 = std::cos(numbers::pi * i / height);
+    const Real cos1 = std::cos(numbers::pi * (i + 1) / height);
+    return 2 * numbers::pi / width * (cos0 - cos1);
+}
+
+} //namespace
+
+EnvironmentLight::EnvironmentLight(const Image& image, const Color& scale, Real radius)
+    : width{image.dimensions().width}, height{image.dimensions().height},
+      sceneRadius{radius}
+{
+    pixels.reserve(width * height);
+    std::vector<Real> weights;
+    weights.reserve(width * height);
+
+    for (Index i : numbers::range(0, height))
+    {
+        const Real solidAngle = pixelSolidAngle(i, width, height);
+        for (Index j : numbers::range(0, width))
+        {
+            const Color color = Color{image.red(i, j), image.green(i, j), image.blue(i, j)} * scale;
+            pixels.push_back(color);
+            weights.push_back(color.luminance() * solidAngle);
+        }
+    }
+
+    table = AliasTable{weights};
+}
+
+Index EnvironmentLight::pixel(const Direction& d) const
+{
+    const Real cosTheta = numbers::max(Real(-1), numbers::min(Real(1), d[1]));
+    Real phi = std::atan2(d[0], d[2]);
+    if (phi < 0)
+        phi += 2 * numbers::pi;
+
+    const Index i = numbers::min(Index(std::acos(cosTheta) / numbers::pi * height), height - 1);
+    const Index j = numbers::min(Index(phi / (2 * numbers::pi) * width), width - 1);
+    return i * width + j;
+}
+
+Color EnvironmentLight::radiance(const Direction& d) const
+{
+    return pixels[pixel(d)];
+}
+
+EnvironmentLight::Sample EnvironmentLight::sample(Randomizer& random) const
+{
+    if (table.empty())
+        return {{0, 1, 0}, {}, 0};
+
+    const Index p = table.sample(random);
+    const Index i = p / width, j = p % width;
+
+    // Uniform over the solid angle of the pixel
+    const Real cos0 = std::cos(numbers::pi * i / height);
+    const Real cos1 = std::cos(numbers::pi * (i + 1) / height);
+    const Real cosTheta = cos0 + (cos1 - cos0) * random();
+    const Real sinTheta = std::sqrt(numbers::max(Real(0), 1 - cosTheta * cosTheta));
+    const Real phi = 2 * numbers::pi * (j + random()) / width;
+
+    const Direction d {sinTheta * std::sin(phi), cosTheta, sinTheta * std::cos(phi)};
+    return {d, pixels[p], table.probability(p) / pixelSolidAngle(i, width, height)};
+}
+
+Real EnvironmentLight::pdf(const Direction& d) const
+{
+    if (table.empty())
+        return 0;
+
+    const Index p = pixel(d);
+    return table.probability(p) / pixelSolidAngle(p / width, width, height);
+}
+
+Real EnvironmentLight::power() const
+{
+    Real sum = 0;
+    for (Index i : numbers::range(0, height))
+    {
+        const Real solidAngle = pixelSolidAngle(i, width, height);
+        for (Index j : numbers::range(0, width))
+            sum += pixels[i * width + j].luminance() * solidAngle;
+    }
+    return numbers::pi * sceneRadius * sceneRadius * sum;
+}
+
+std::unique_ptr<EnvironmentLight> makeEnvironmentLight(std::string_view path,
+        const Color& scale, Real radius)
+{
+    auto reader = makeImageReader(path);
+    Image image;
+    if (reader == nullptr || !reader->read(image))
+        return nullptr;
+
+    return std::make_unique<EnvironmentLight>(image, scale, radius);
+}
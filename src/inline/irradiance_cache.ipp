@@ -0,0 +1,50 @@
+#pragma once
+
+#include "irradiance_cache.hpp"
+
+template <typename RadianceFunction>
+Color IrradianceCache::irradiance(const Point& p, const Direction& n,
+        RadianceFunction&& radiance, Randomizer& random)
+{
+    Color e;
+    {
+        std::shared_lock lock {mtx};
+        if (interpolate(p, n, e))
+            return e;
+    }
+
+    const Direction u = (std::abs(n[0]) < 0.1)
+        ? normalize(Direction{0, n[2], -n[1]})
+        : normalize(Direction{n[1], -n[0], 0});
+    const Direction v = cross(n, u);
+
+    std::vector<RadianceSample> samples;
+    samples.reserve(thetaDivisions * phiDivisions);
+    for (Index j : numbers::range(0, thetaDivisions))
+    for (Index k : numbers::range(0, phiDivisions))
+    {
+        const Real sin2Theta = (j + random()) / thetaDivisions;
+        const Real sinTheta = std::sqrt(sin2Theta);
+        const Real cosTheta = std::sqrt(1 - sin2Theta);
+        const Real phi = 2 * numbers::pi * (k + random()) / phiDivisions;
+
+        const Direction d = n * cosTheta
+                          + u * (sinTheta * std::cos(phi))
+                          + v * (sinTheta * std::sin(phi));
+        samples.push_back(radiance(Ray{p + d * 0.0001, d}));
+    }
+
+    Record record = computeRecord(p, n, samples, u, v);
+    e = record.e;
+
+    std::unique_lock lock {mtx};
+    const Real halfSize = record.radius * error;
+    const Point min = p + Direction{-halfSize, -halfSize, -halfSize};
+    const Point max = p + Direction{halfSize, halfSize, halfSize};
+    grow(p, halfSize);
+
+    records.push_back(record);
+    insert(0, rootCenter, rootHalfSize, min, max, records.size() - 1);
+
+    return e;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "photon_mapping.hpp"
+
+#include <bit>
+#include <cmath>
+
+namespace PhotonMapping {
+
+inline PackedFlux::PackedFlux(const Color& flux)
+{
+    const RGBPixel c = flux;
+    const Real largest = numbers::max(c.r, c.g, c.b);
+
+    // largest = m * 2^exponent, m in [0.5, 1), so mantissas are scaled by
+    // 2^(exponent - 8) to take 8 bits
+    int exponent = 0;
+    std::frexp(largest, &exponent);
+    const int biased = numbers::min(exponent - 8 + 127, 254);
+    if (!(largest > 0) || biased < 1) // Smaller than the smallest normal scale
+    {
+        r = g = b = e = 0;
+        return;
+    }
+
+    const Real scale = std::bit_cast<Real>(std::uint32_t(biased) << 23);
+    auto mantissa = [scale](Real x)
+    {
+        return std::uint8_t(numbers::min(numbers::max(x, Real(0)) / scale + Real(0.5), Real(255)));
+    };
+    r = mantissa(c.r);
+    g = mantissa(c.g);
+    b = mantissa(c.b);
+    e = biased;
+}
+
+inline PackedFlux::operator Color() const
+{
+    const Real scale = std::bit_cast<Real>(std::uint32_t(e) << 23); // 0 for a zero flux
+    return {r * scale, g * scale, b * scale};
+}
+
+inline PackedDirection::PackedDirection(const Direction& d)
+{
+    // Projected onto the octahedron, with the lower half folded outwards
+    const Real l1 = std::abs(d[0]) + std::abs(d[1]) + std::abs(d[2]);
+    Real x = d[0] / l1, y = d[1] / l1;
+    if (d[2] < 0)
+    {
+        const Real folded = (1 - std::abs(y)) * std::copysign(Real(1), x);
+        y = (1 - std::abs(x)) * std::copysign(Real(1), y);
+        x = folded;
+    }
+
+    auto quantize = [](Real t) { return std::uint8_t(std::lround((t + 1) * Real(127.5))); };
+    u = quantize(x);
+    v = quantize(y);
+}
+
+inline PackedDirection::operator Direction() const
+{
+    Real x = u / Real(127.5) - 1, y = v / Real(127.5) - 1;
+    const Real z = 1 - std::abs(x) - std::abs(y);
+    if (z < 0)
+    {
+        const Real folded = (1 - std::abs(y)) * std::copysign(Real(1), x);
+        y = (1 - std::abs(x)) * std::copysign(Real(1), y);
+        x = folded;
+    }
+    return normalize(Direction{x, y, z});
+}
+
+} //namespace PhotonMapping
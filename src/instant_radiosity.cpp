@@ -0,0 +1,259 @@
+#include "instant_radiosity.hpp"
+
+#include <cmath>
+
+using namespace InstantRadiosity;
+
+InstantRadiosity::Renderer::
+Renderer(const Index numWorkers, const Index queueSize,
+        const TaskDivider& divider)
+    : tasks{queueSize}, taskDivider{divider}
+{
+    auto hw = std::thread::hardware_concurrency();
+    const Index nThreads = numWorkers <= 0
+            ? numbers::max(hw, (decltype(hw))1)
+            : numWorkers;
+
+    threadPool.resize(nThreads);
+}
+
+Index InstantRadiosity::Renderer::
+numThreads()
+{
+    return threadPool.size();
+}
+
+namespace {
+
+void leaderRoutine(TaskQueue& tasks, TaskDivider& divider)
+{
+    Task task;
+    while (divider.getNextTask(task))
+    {
+        tasks.enqueue(task);
+    }
+    tasks.stop(); // Tell threads not to block if queue is empty, but to quit
+}
+
+// Traces light paths until `total` VPLs are left in the scene, or until
+// `maxCastsPerVPL` paths have been traced per VPL, if few of them reach a
+// diffuse surface.
+std::vector<VirtualPointLight> castVirtualPointLights(const ObjectSet& objSet,
+        Index total, Randomizer& random)
+{
+    constexpr Index maxCastsPerVPL = 1000;
+
+    std::vector<VirtualPointLight> vpls;
+    const Index numLights = objSet.pointLights.size();
+    if (numLights == 0)
+        return vpls;
+
+    vpls.reserve(total);
+    Index casted = 0;
+    while (vpls.size() < total && casted < maxCastsPerVPL * total)
+    {
+        const Index chosen = numbers::min(Index(random() * numLights), numLights - 1);
+        const PointLight& light = objSet.pointLights[chosen];
+
+        // Power of the chosen light over its probability of being chosen
+        Color flux = 4 * numbers::pi * light.color() * numLights;
+
+        const Real cosLat = 2 * random() - 1;
+        const Real sinLat = std::sqrt(numbers::max(Real(0), 1 - cosLat * cosLat));
+        const Real az = 2 * numbers::pi * random();
+        Ray ray {light.position(), {sinLat * std::sin(az), cosLat, sinLat * std::cos(az)}};
+        casted++;
+
+        for ([[maybe_unused]] Index bounce : numbers::range(0, maxBounces))
+        {
+            if (vpls.size() == total)
+                break;
+
+            const auto [t, hitObj] = findIntersection(objSet, ray);
+            if (!Ray::isHit(t))
+                break;
+
+            const auto& material = hitObj->material();
+            if (material.emission().emits)
+                break;
+
+            const auto hit = ray.hitPoint(t);
+            const auto normal = hitObj->shape().normal(ray.d, hit);
+
+            // Lambertian reflection of the incoming flux, slightly lifted
+            // from the surface so that it does not shadow itself
+            if (material.kd().luminance() > 0)
+                vpls.push_back({hit + normal.normal * 0.001, normal.normal,
+                                flux * material.kd() / numbers::pi});
+
+            Ray secondaryRay;
+            const auto [color, k] = material.eval(hit, ray, secondaryRay, normal, random);
+            if (k == Material::Component::ka)
+                break;
+
+            flux = flux * color;
+            ray = secondaryRay;
+        }
+    }
+
+    for (auto& vpl : vpls)
+        vpl.intensity = vpl.intensity / casted;
+
+    return vpls;
+}
+
+/* Light from the VPLs reflected at `hit` with diffuse coefficient `kd`.
+   Only one out of every `stride` VPLs is gathered, starting at `first`, so
+   that the samples of a pixel share the whole set between them. */
+Color gatherVirtualPointLights(const ObjectSet& objSet,
+        const std::vector<VirtualPointLight>& vpls, Index first, Index stride,
+        const Direction& normal, const Point& hit, const Color& kd, Real minDistance)
+{
+    const Real minDistance2 = minDistance * minDistance;
+
+    Color color {0, 0, 0};
+    for (Index v = first; v < vpls.size(); v += stride)
+    {
+        const auto& vpl = vpls[v];
+        const Direction d = vpl.position - hit;
+        const Real d2 = dot(d, d);
+        const Direction dN = d / std::sqrt(d2);
+
+        const Real cosHit = dot(normal, dN);
+        const Real cosLight = -dot(vpl.normal, dN);
+        if (cosHit <= 0 || cosLight <= 0)
+            continue;
+
+        // castShadowRay divides by the actual squared distance
+        const Real clamp = d2 / numbers::max(d2, minDistance2);
+        const PointLight light {vpl.position, vpl.intensity * (cosLight * clamp)};
+        color = color + castShadowRay(objSet, light, normal, hit, kd);
+    }
+    return color * stride;
+}
+
+/* Shades the diffuse component of every hit with the lights of the scene
+   and the VPLs, and follows one of its specular or refractive components.
+   Diffuse shading does not depend on random choices, which would leave
+   black pixels when only a few samples are taken. This is sample `sample`
+   out of `ppp`. */
+Color trace(const ObjectSet& objSet, const std::vector<VirtualPointLight>& vpls,
+        Ray ray, Index sample, Index ppp, Real minDistance, Randomizer& random)
+{
+    Color color {0, 0, 0};
+    Color throughput {1, 1, 1};
+    for ([[maybe_unused]] Index bounce : numbers::range(0, maxBounces))
+    {
+        const auto [t, hitObj] = findIntersection(objSet, ray);
+        if (!Ray::isHit(t))
+            break;
+
+        const auto& material = hitObj->material();
+        const auto [emits, emission] = material.emission();
+        if (emits)
+            return color + throughput * emission;
+
+        const auto hit = ray.hitPoint(t);
+        const auto normal = hitObj->shape().normal(ray.d, hit);
+
+        // Diffuse bounces are never sampled, so area lights are only found
+        // by shadow rays
+        if (material.kd().luminance() > 0)
+        {
+            const Color kd = throughput * material.kd();
+            color = color
+                  + castShadowRays(objSet, normal.normal, hit, kd, random)
+                  + castAreaShadowRay(objSet, normal.normal, hit, kd, random, nullptr, true)
+                  + gatherVirtualPointLights(objSet, vpls, sample, ppp,
+                                             normal.normal, hit, kd, minDistance);
+        }
+
+        const Real ps = material.ks().luminance(), pt = material.kt().luminance();
+        if (ps + pt <= 0)
+            break;
+
+        const auto rays = material.sampleAll(hit, ray, normal, random);
+        if (random() * (ps + pt) < ps)
+        {
+            throughput = throughput * material.ks() * ((ps + pt) / ps);
+            ray = rays.rs;
+        }
+        else
+        {
+            throughput = throughput * material.kt() * ((ps + pt) / pt);
+            ray = rays.rt;
+        }
+    }
+
+    return color;
+}
+
+void workerRoutine(TaskQueue& tasks, Real increment, const Camera& camera,
+        Image& img, const ObjectSet& objects,
+        const std::vector<VirtualPointLight>& vpls, Index ppp, Real minDistance,
+        TextProgressBar& progressBar)
+{
+    // Each thread has its own unique camera, to avoid critical section
+    // at generating random numbers.
+    Camera cam {camera};
+    Randomizer random {0.0, 1.0};
+    Task task {};
+
+    while (tasks.dequeue(task))
+    {
+        for (Index i : numbers::range(task.start.i, task.end.i)) //for i = start.i .. end.i
+        for (Index j : numbers::range(task.start.j, task.end.j))
+        {
+            Color meanColor {0, 0, 0};
+            for (Index k : numbers::range(0, ppp))
+            {
+                Ray ray = cam.randomRay(i, j);
+                meanColor = meanColor + trace(objects, vpls, ray, k, ppp, minDistance, random);
+            }
+            // Thread-safe operation: a pixel is not assigned to two different threads
+            img(i, j) = RGBPixel (meanColor / ppp);
+        }
+        progressBar.incrementProgress(increment);
+    }
+}
+
+} //namespace
+
+void InstantRadiosity::Renderer::
+render(const Camera& cam, Image& img, const ObjectSet& objects,
+        Index ppp, Index numLights, Real minDistance)
+{
+    std::cout << "Algorithm: instant radiosity\n";
+    std::cout << "Worker pool size: " << numThreads() << "\n\n";
+
+    Randomizer random {0.0, 1.0};
+    const auto vpls = castVirtualPointLights(objects, numLights, random);
+    std::cout << "Virtual point lights: " << vpls.size() << "\n";
+
+    const Real totalSize = taskDivider.width * taskDivider.height;
+    const Real regionSize = taskDivider.regionWidth * taskDivider.regionHeight;
+    const Real increment = regionSize / totalSize;
+
+    TextProgressBar progressBar {std::cout};
+
+    leader = std::thread(leaderRoutine,
+            std::ref(tasks), std::ref(taskDivider));
+    for (auto& worker : threadPool)
+    {
+        worker = std::thread(workerRoutine, std::ref(tasks), increment,
+                std::ref(cam), std::ref(img), std::ref(objects), std::cref(vpls),
+                ppp, minDistance, std::ref(progressBar));
+    }
+
+    std::cout << "Rendering...\n";
+    progressBar.launch(true);
+
+    leader.join();
+    for (auto& worker : threadPool)
+        worker.join();
+
+    progressBar.stop();
+    progressBar.join();
+
+    img.updateLuminance();
+}
@@ -0,0 +1,243 @@
+#include "irradiance_cache.hpp"
+
+namespace {
+
+Color clampNegative(const Color& c)
+{
+    const RGBPixel p = c;
+    return {numbers::max(p.r, Real(0)), numbers::max(p.g, Real(0)), numbers::max(p.b, Real(0))};
+}
+
+Color dot(const Direction& d, const std::array<Color, 3>& gradient)
+{
+    return gradient[0] * d[0] + gradient[1] * d[1] + gradient[2] * d[2];
+}
+
+} //namespace
+
+IrradianceCache::IrradianceCache(Real error)
+    : error{error}
+{}
+
+void IrradianceCache::setView(const Camera& cam)
+{
+    eye = cam.position();
+    spread = cam.spread();
+}
+
+Index IrradianceCache::size() const
+{
+    std::shared_lock lock {mtx};
+    return records.size();
+}
+
+void IrradianceCache::grow(const Point& p, Real halfSize)
+{
+    if (nodes.empty())
+    {
+        nodes.emplace_back();
+        rootCenter = p;
+        rootHalfSize = 4 * halfSize;
+    }
+
+    auto contains = [&]()
+    {
+        for (int a = 0; a < 3; a++)
+            if (std::abs(p[a] - rootCenter[a]) + halfSize > rootHalfSize)
+                return false;
+        return true;
+    };
+
+    // Old root becomes a child of a root twice as big, expanding towards p
+    while (!contains())
+    {
+        Point center;
+        Index child = 0;
+        for (int a = 0; a < 3; a++)
+        {
+            const bool towardsLower = p[a] < rootCenter[a];
+            center[a] = rootCenter[a] + (towardsLower ? -rootHalfSize : rootHalfSize);
+            if (towardsLower)
+                child |= (1 << a); // old root is at the upper side of this axis
+        }
+
+        Node old = std::move(nodes[0]);
+        nodes[0] = Node{};
+        nodes.push_back(std::move(old));
+        nodes[0].children[child] = nodes.size() - 1;
+        rootCenter = center;
+        rootHalfSize *= 2;
+    }
+}
+
+void IrradianceCache::insert(Index node, const Point& center, Real halfSize,
+        const Point& min, const Point& max, Index record)
+{
+    // Store at the deepest level whose nodes are not smaller than the record
+    if (halfSize / 2 < (max[0] - min[0]) / 2)
+    {
+        nodes[node].records.push_back(record);
+        return;
+    }
+
+    const Real childHalf = halfSize / 2;
+    for (Index c : numbers::range(0, 8))
+    {
+        Point childCenter;
+        bool overlaps = true;
+        for (int a = 0; a < 3; a++)
+        {
+            childCenter[a] = center[a] + ((c & (1 << a)) ? childHalf : -childHalf);
+            overlaps = overlaps && min[a] <= childCenter[a] + childHalf
+                                && max[a] >= childCenter[a] - childHalf;
+        }
+
+        if (!overlaps)
+            continue;
+
+        if (nodes[node].children[c] == 0)
+        {
+            nodes[node].children[c] = nodes.size();
+            nodes.emplace_back(); // invalidates references to nodes
+        }
+        insert(nodes[node].children[c], childCenter, childHalf, min, max, record);
+    }
+}
+
+bool IrradianceCache::interpolate(const Point& p, const Direction& n, Color& e) const
+{
+    if (nodes.empty())
+        return false;
+
+    for (int a = 0; a < 3; a++)
+        if (std::abs(p[a] - rootCenter[a]) > rootHalfSize)
+            return false;
+
+    Color sum;
+    Real weights = 0;
+
+    Index node = 0;
+    Point center = rootCenter;
+    Real halfSize = rootHalfSize;
+    for (;;)
+    {
+        for (Index idx : nodes[node].records)
+        {
+            const Record& r = records[idx];
+            const Direction d = p - r.p;
+            const Real w = 1 / (norm(d) / r.radius
+                                + std::sqrt(numbers::max(Real(0), 1 - dot(n, r.n))));
+            if (w * error <= 1)
+                continue;
+
+            // Discard records in front of p
+            if (dot(d, n + r.n) < -0.1 * r.radius)
+                continue;
+
+            const Color extrapolated = r.e + dot(cross(r.n, n), r.gradR) + dot(d, r.gradT);
+            sum = sum + extrapolated * w;
+            weights += w;
+        }
+
+        Index c = 0;
+        for (int a = 0; a < 3; a++)
+            if (p[a] > center[a])
+                c |= (1 << a);
+
+        if (nodes[node].children[c] == 0)
+            break;
+
+        node = nodes[node].children[c];
+        halfSize /= 2;
+        for (int a = 0; a < 3; a++)
+            center[a] += (c & (1 << a)) ? halfSize : -halfSize;
+    }
+
+    if (weights <= 0)
+        return false;
+
+    e = clampNegative(sum / weights);
+    return true;
+}
+
+IrradianceCache::Record IrradianceCache::computeRecord(const Point& p, const Direction& n,
+        const std::vector<RadianceSample>& samples,
+        const Direction& u, const Direction& v) const
+{
+    constexpr Index M = thetaDivisions, N = phiDivisions;
+
+    auto L = [&](Index j, Index k) { return samples[j * N + (k % N)].radiance; };
+    auto r = [&](Index j, Index k)
+    {
+        const Real t = samples[j * N + (k % N)].distance;
+        return Ray::isHit(t) ? numbers::max(t, Real(1e-4)) : 1e6f;
+    };
+    auto minus = [](const Color& a, const Color& b) { return a + b * -1; };
+
+    Record record;
+    record.p = p;
+    record.n = n;
+
+    Real inverseDistances = 0;
+    for (Index j : numbers::range(0, M))
+    for (Index k : numbers::range(0, N))
+    {
+        record.e = record.e + L(j, k);
+        inverseDistances += 1 / r(j, k);
+    }
+    record.e = record.e * (numbers::pi / (M * N));
+    const Real width = spread * norm(p - eye);
+    record.radius = numbers::min(numbers::max((M * N) / inverseDistances, minRadius * width),
+                                 maxRadius * width);
+
+    // Gradients in the local frame (u, v, n)
+    Color transU, transV, rotU, rotV;
+    for (Index k : numbers::range(0, N))
+    {
+        const Real phi = 2 * numbers::pi * (k + 0.5) / N;
+        const Real phiMinus = 2 * numbers::pi * k / N;
+        const Real cosPhi = std::cos(phi), sinPhi = std::sin(phi);
+        const Real cosPhiMinus = std::cos(phiMinus), sinPhiMinus = std::sin(phiMinus);
+
+        // Changes between elevation strata, along the azimuth direction
+        Color alongTheta;
+        for (Index j : numbers::range(1, M))
+        {
+            const Real sin2ThetaMinus = Real(j) / M;
+            const Real factor = std::sqrt(sin2ThetaMinus) * (1 - sin2ThetaMinus)
+                              / numbers::min(r(j, k), r(j - 1, k));
+            alongTheta = alongTheta + minus(L(j, k), L(j - 1, k)) * factor;
+        }
+        alongTheta = alongTheta * (2 * numbers::pi / N);
+        transU = transU + alongTheta * cosPhi;
+        transV = transV + alongTheta * sinPhi;
+
+        // Changes between azimuth strata, perpendicular to their boundary
+        Color alongPhi, rotation;
+        for (Index j : numbers::range(0, M))
+        {
+            const Real sinThetaMinus = std::sqrt(Real(j) / M);
+            const Real sinThetaPlus = std::sqrt(Real(j + 1) / M);
+            const Real sinThetaCenter = std::sqrt((j + 0.5) / M);
+            const Real cosThetaCenter = std::sqrt(1 - (j + 0.5) / M);
+            const Real factor = (sinThetaPlus - sinThetaMinus)
+                              / numbers::min(r(j, k), r(j, k + N - 1));
+            alongPhi = alongPhi + minus(L(j, k), L(j, k + N - 1)) * factor;
+            rotation = rotation + L(j, k) * (sinThetaCenter / cosThetaCenter);
+        }
+        transU = transU + alongPhi * -sinPhiMinus;
+        transV = transV + alongPhi * cosPhiMinus;
+        rotU = rotU + rotation * -sinPhi;
+        rotV = rotV + rotation * cosPhi;
+    }
+    rotU = rotU * (numbers::pi / (M * N));
+    rotV = rotV * (numbers::pi / (M * N));
+
+    for (int a = 0; a < 3; a++)
+    {
+        record.gradT[a] = transU * u[a] + transV * v[a];
+        record.gradR[a] = rotU * u[a] + rotV * v[a];
+    }
+
+    return record;
+}
@@ -0,0 +1,163 @@
+#include "light_tree.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Point lights emit equally in every direction
+const LightTree::Cone pointLightCone {Direction{0, 1, 0}, numbers::pi, numbers::pi / 2};
+
+Real angle(const Direction& u, const Direction& v)
+{
+    return std::acos(numbers::max(Real(-1), numbers::min(Real(1), dot(u, v))));
+}
+
+// Smallest cone (approximately) containing both cones
+LightTree::Cone merge(LightTree::Cone a, LightTree::Cone b)
+{
+    if (b.offset > a.offset)
+        std::swap(a, b);
+
+    const Real emission = numbers::max(a.emission, b.emission);
+    const Real between = angle(a.axis, b.axis);
+    if (numbers::min(between + b.offset, numbers::pi) <= a.offset)
+        return {a.axis, a.offset, emission};
+
+    const Real offset = (a.offset + between + b.offset) / 2;
+    if (offset >= numbers::pi)
+        return {a.axis, numbers::pi, emission};
+
+    // Rotate a.axis towards b.axis around their perpendicular (Rodrigues)
+    const Real rotation = offset - a.offset;
+    const Direction k = normalize(cross(a.axis, b.axis));
+    const Direction axis = a.axis * std::cos(rotation)
+                         + cross(k, a.axis) * std::sin(rotation);
+    return {normalize(axis), offset, emission};
+}
+
+} //namespace
+
+LightTree::LightTree(const std::vector<PointLight>& lights, Index samplesPerPoint)
+    : samples{samplesPerPoint}
+{
+    if (lights.empty())
+        return;
+
+    std::vector<Index> order(lights.size());
+    for (Index i : numbers::range(0, lights.size()))
+        order[i] = i;
+
+    nodes.reserve(2 * lights.size() - 1);
+    build(lights, order, 0, lights.size());
+}
+
+Index LightTree::build(const std::vector<PointLight>& lights, std::vector<Index>& order,
+        Index begin, Index end)
+{
+    const Index current = nodes.size();
+    nodes.emplace_back();
+
+    if (end - begin == 1)
+    {
+        const auto& light = lights[order[begin]];
+        nodes[current] = Node{light.position(), light.position(),
+                light.color().luminance(), pointLightCone,
+                order[begin], 0, true};
+        return current;
+    }
+
+    // Split by the median along the largest axis
+    Point min = lights[order[begin]].position(), max = min;
+    for (Index i : numbers::range(begin + 1, end))
+    {
+        const Point p = lights[order[i]].position();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            min[axis] = numbers::min(min[axis], p[axis]);
+            max[axis] = numbers::max(max[axis], p[axis]);
+        }
+    }
+
+    int axis = 0;
+    for (int i = 1; i < 3; i++)
+        if (max[i] - min[i] > max[axis] - min[axis])
+            axis = i;
+
+    const Index median = (begin + end) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + median, order.begin() + end,
+        [&](Index a, Index b)
+        {
+            return lights[a].position()[axis] < lights[b].position()[axis];
+        });
+
+    const Index left = build(lights, order, begin, median);
+    const Index right = build(lights, order, median, end);
+
+    const Node& l = nodes[left];
+    const Node& r = nodes[right];
+    nodes[current] = Node{min, max, l.power + r.power, merge(l.cone, r.cone),
+            left, right, false};
+    return current;
+}
+
+Real LightTree::importance(const Node& node, const Point& p, const Direction& n) const
+{
+    const Direction half = (node.max - node.min) / 2;
+    const Point center = node.min + half;
+    const Real radius2 = dot(half, half);
+
+    const Direction toCenter = center - p;
+    const Real d2 = dot(toCenter, toCenter);
+
+    // Shading point inside the bounds: every direction is possible
+    if (d2 <= radius2)
+        return node.power / numbers::max(radius2, Real(1e-8));
+
+    const Real distance = std::sqrt(d2);
+    const Direction dir = toCenter / distance;
+    const Real uncertainty = std::asin(std::sqrt(radius2 / d2));
+
+    // Lights are evaluated at both sides of the surface, as castShadowRays does
+    const Real incidence = angle(n, dir);
+    const Real twoSided = numbers::min(incidence, numbers::pi - incidence);
+    const Real cosIncidence = std::cos(numbers::max(Real(0), twoSided - uncertainty));
+
+    const Real outgoing = angle(node.cone.axis, -1 * dir);
+    const Real bounded = numbers::max(Real(0), outgoing - node.cone.offset - uncertainty);
+    if (bounded >= node.cone.emission)
+        return 0;
+
+    return node.power * cosIncidence * std::cos(bounded) / d2;
+}
+
+LightTree::Sample LightTree::sample(const Point& p, const Direction& n,
+        Randomizer& random) const
+{
+    if (nodes.empty())
+        return {0, 0};
+
+    Index current = 0;
+    Real pdf = 1;
+    while (!nodes[current].leaf)
+    {
+        const Node& node = nodes[current];
+        const Real left = importance(nodes[node.left], p, n);
+        const Real right = importance(nodes[node.right], p, n);
+        if (left + right <= 0)
+            return {0, 0};
+
+        const Real pLeft = left / (left + right);
+        if (random() < pLeft)
+        {
+            current = node.left;
+            pdf *= pLeft;
+        }
+        else
+        {
+            current = node.right;
+            pdf *= 1 - pLeft;
+        }
+    }
+
+    return {nodes[current].left, pdf};
+}
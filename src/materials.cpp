@@ -1,4 +1,5 @@
 #include "materials.hpp"
+#include "fast_math.hpp"
 
 #include <tuple>
 
@@ -10,17 +11,12 @@ Direction uniformCosineSampling(const Direction& normal, Randomizer& random)
 
     const Direction ortogonal2 = cross(ortogonal1, normal);
 
-    const Real sin2Lat = random();
-    const Real cosLat = std::sqrt(1 - sin2Lat);
-    const Real sinLat = std::sqrt(sin2Lat);
+    const Real u1 = random(), u2 = random();
+    const Direction local = fastmath::cosineHemisphere(u1, u2);
 
-    const Real az = 2 * numbers::pi * random();
-    const Real sinAz = std::sin(az);
-    const Real cosAz = std::cos(az);
-
-    const Direction rotatedDirection = normal * cosLat 
-                                     + ortogonal2 * (sinLat * cosAz)
-                                     + ortogonal1 * (sinLat * sinAz);
+    const Direction rotatedDirection = normal * local[2]
+                                     + ortogonal2 * local[0]
+                                     + ortogonal1 * local[1];
 
     return rotatedDirection;
 }
@@ -35,33 +31,26 @@ Direction perfectSpecularRefraction(const Shape::Normal& normal, const Direction
     const Direction n = -1 * normal.normal;
     const Real index = normal.side == Shape::Side::in ? refIndex : 1 / refIndex;
     
-    const Real cosOut = dot(dir, n);
-
-    /* if (std::abs(cosOut) > 0.99999)
-        return n; */
-
-    const Real sinIn = std::sin(std::acos(cosOut)) * index;
-    const Real in = std::asin(sinIn);
-    const Real cosIn = std::cos(in);
-
-    const Direction rotRef = normalize(cross(n, dir));
-    const Direction ortogonal2 = cross(rotRef, n);
-
-    const Direction rotatedDirection = n * cosIn + ortogonal2 * sinIn;
-
-    return normalize(rotatedDirection);
+    // Totally reflected rays stay on the same side
+    return normalize(fastmath::refract(dir, n, index).d);
 }
 
-Material::Evaluation Material::eval(const Point& hit, const Ray& wIn, Ray& wOut,
-        const Shape::Normal& normal, Randomizer& random) const
+Material::Probabilities Material::evalProbabilities() const
 {
-    // Russian Roulette
     Real pd = _kd.luminance(), ps = _ks.luminance(), pt = _kt.luminance();
     if (const Real sum = pd + ps + pt; sum > 1)
     {
         const Real divisor = 1.1 * sum; // leave absorption probability
         pd /= divisor; ps /= divisor; pt /= divisor;
     }
+    return {pd, ps, pt};
+}
+
+Material::Evaluation Material::eval(const Point& hit, const Ray& wIn, Ray& wOut,
+        const Shape::Normal& normal, Randomizer& random) const
+{
+    // Russian Roulette
+    const auto [pd, ps, pt] = evalProbabilities();
 
     auto setWOut = [&](const Direction& dir)
     {
@@ -90,6 +79,14 @@ Material::Evaluation Material::eval(const Point& hit, const Ray& wIn, Ray& wOut,
     return {Color{}, Component::ka};
 }
 
+Real Material::diffusePdf(const Direction& normal, const Direction& wOut) const
+{
+    const Real cosine = dot(normal, wOut);
+    if (cosine <= 0)
+        return 0;
+    return evalProbabilities().pd * cosine / numbers::pi;
+}
+
 Material::Sample Material::sample(const Point& hit, const Ray& wIn,
         const Shape::Normal& normal, Randomizer& random) const
 {
@@ -0,0 +1,305 @@
+#include "path_guiding.hpp"
+
+#include <cmath>
+
+namespace {
+
+struct SquarePoint { Real u, v; };
+
+// Area preserving mapping between the sphere and the unit square
+SquarePoint toSquare(const Direction& d)
+{
+    const Real cosTheta = numbers::min(numbers::max(d[1], Real(-1)), Real(1));
+    Real phi = std::atan2(d[2], d[0]);
+    if (phi < 0)
+        phi += 2 * numbers::pi;
+
+    constexpr Real last = 1 - 1e-6; // keep inside [0, 1)
+    return {numbers::min((cosTheta + 1) / 2, last),
+            numbers::min(phi / (2 * numbers::pi), last)};
+}
+
+Direction toSphere(SquarePoint s)
+{
+    const Real cosTheta = 2 * s.u - 1;
+    const Real sinTheta = std::sqrt(numbers::max(Real(0), 1 - cosTheta * cosTheta));
+    const Real phi = 2 * numbers::pi * s.v;
+    return {sinTheta * std::cos(phi), cosTheta, sinTheta * std::sin(phi)};
+}
+
+// Quadrant of the unit square containing s, which is rescaled to it
+Index quadrant(SquarePoint& s)
+{
+    Index q = 0;
+    if (s.u >= 0.5) { q |= 1; s.u -= 0.5; }
+    if (s.v >= 0.5) { q |= 2; s.v -= 0.5; }
+    s.u *= 2;
+    s.v *= 2;
+    return q;
+}
+
+} //namespace
+
+//------------------------------------------------------------------------------
+
+DirectionalTree::Node::Node(const Node& other)
+    : child{other.child}
+{
+    for (Index q : numbers::range(0, 4))
+        sum[q].store(other.sum[q].load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+DirectionalTree::Node& DirectionalTree::Node::operator=(const Node& other)
+{
+    child = other.child;
+    for (Index q : numbers::range(0, 4))
+        sum[q].store(other.sum[q].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+}
+
+Real DirectionalTree::Node::total() const
+{
+    Real t = 0;
+    for (const auto& s : sum)
+        t += s.load(std::memory_order_relaxed);
+    return t;
+}
+
+DirectionalTree::DirectionalTree()
+    : nodes(1)
+{}
+
+void DirectionalTree::record(const Direction& d, Real radiance)
+{
+    if (!(radiance > 0))
+        return;
+
+    SquarePoint s = toSquare(d);
+    Index node = 0;
+    for (;;)
+    {
+        const Index q = quadrant(s);
+        nodes[node].sum[q].fetch_add(radiance, std::memory_order_relaxed);
+        if (nodes[node].child[q] == 0)
+            return;
+        node = nodes[node].child[q];
+    }
+}
+
+void DirectionalTree::refine(const DirectionalTree& previous, Index src, Index dst,
+        Real total, Real threshold, Index depth)
+{
+    // `src` is 0 when the previous tree had a leaf there, as the root is
+    // never a child. Its energy is then assumed to be uniform.
+    const Real leafEnergy = (src == 0 && depth > 1) ? nodes[dst].total() : 0;
+
+    for (Index q : numbers::range(0, 4))
+    {
+        const Real energy = (src != 0 || depth == 1)
+                ? previous.nodes[src].sum[q].load(std::memory_order_relaxed)
+                : leafEnergy / 4;
+
+        if (energy / total <= threshold || depth >= maxDepth)
+            continue;
+
+        const Index c = nodes.size();
+        nodes[dst].child[q] = c;
+        nodes.emplace_back();
+        // Energy is kept temporarily to refine the leaves of previous tree
+        for (auto& s : nodes[c].sum)
+            s.store(energy / 4, std::memory_order_relaxed);
+
+        const Index childSrc = (src != 0 || depth == 1) ? previous.nodes[src].child[q] : 0;
+        refine(previous, childSrc, c, total, threshold, depth + 1);
+    }
+}
+
+DirectionalTree DirectionalTree::refined(Real threshold) const
+{
+    DirectionalTree tree;
+    const Real total = nodes[0].total();
+    if (total <= 0)
+        return tree;
+
+    tree.refine(*this, 0, 0, total, threshold, 1);
+
+    for (auto& node : tree.nodes)
+        for (auto& s : node.sum)
+            s.store(0, std::memory_order_relaxed);
+    return tree;
+}
+
+Direction DirectionalTree::sample(Randomizer& random) const
+{
+    Real u = random(), v = random();
+
+    if (nodes[0].total() <= 0)
+        return toSphere({u, v});
+
+    SquarePoint origin {0, 0};
+    Real size = 1;
+    Index node = 0;
+    for (;;)
+    {
+        const auto& n = nodes[node];
+        const Real total = n.total();
+
+        // Choose a quadrant proportionally to its energy
+        Real x = random() * total;
+        Index q = 0;
+        while (q < 3 && x >= n.sum[q].load(std::memory_order_relaxed))
+        {
+            x -= n.sum[q].load(std::memory_order_relaxed);
+            q++;
+        }
+
+        size /= 2;
+        if (q & 1) origin.u += size;
+        if (q & 2) origin.v += size;
+
+        if (n.child[q] == 0 || nodes[n.child[q]].total() <= 0)
+            return toSphere({origin.u + u * size, origin.v + v * size});
+        node = n.child[q];
+    }
+}
+
+Real DirectionalTree::pdf(const Direction& d) const
+{
+    constexpr Real sphereArea = 4 * numbers::pi;
+
+    if (nodes[0].total() <= 0)
+        return 1 / sphereArea;
+
+    SquarePoint s = toSquare(d);
+    Real density = 1;
+    Index node = 0;
+    for (;;)
+    {
+        const auto& n = nodes[node];
+        const Index q = quadrant(s);
+        density *= 4 * n.sum[q].load(std::memory_order_relaxed) / n.total();
+
+        if (n.child[q] == 0 || nodes[n.child[q]].total() <= 0)
+            return density / sphereArea;
+        node = n.child[q];
+    }
+}
+
+namespace {
+
+Direction mirror(const Direction& d, const Direction& normal)
+{
+    return d - normal * (2 * dot(d, normal));
+}
+
+} //namespace
+
+Direction DirectionalTree::sample(const Direction& normal, Randomizer& random) const
+{
+    const Direction d = sample(random);
+    return dot(d, normal) < 0 ? mirror(d, normal) : d;
+}
+
+Real DirectionalTree::pdf(const Direction& d, const Direction& normal) const
+{
+    return pdf(d) + pdf(mirror(d, normal));
+}
+
+//------------------------------------------------------------------------------
+
+GuidingTree::GuidingTree(const Point& min, const Point& max)
+{
+    auto& root = nodes.emplace_back();
+    root.min = min;
+    root.max = max;
+}
+
+namespace {
+
+int largestAxis(const Point& min, const Point& max)
+{
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (max[a] - min[a] > max[axis] - min[axis])
+            axis = a;
+    return axis;
+}
+
+} //namespace
+
+Index GuidingTree::leafAt(const Point& p) const
+{
+    Index node = 0;
+    while (!nodes[node].leaf)
+    {
+        const Node& n = nodes[node];
+        const int axis = largestAxis(n.min, n.max);
+        const Real middle = (n.min[axis] + n.max[axis]) / 2;
+        node = n.child[p[axis] < middle ? 0 : 1];
+    }
+    return node;
+}
+
+const DirectionalTree& GuidingTree::distribution(const Point& p) const
+{
+    return nodes[leafAt(p)].sampling;
+}
+
+void GuidingTree::record(const Point& p, const Direction& d, Real radiance)
+{
+    Node& leaf = nodes[leafAt(p)];
+    leaf.building.record(d, radiance);
+    leaf.samples.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GuidingTree::refine(Index pass)
+{
+    const Real maxSamples = splitThreshold * std::sqrt(Real(1 << pass));
+
+    // Spatial subdivision, children inherit the directional trees
+    std::vector<Index> pending;
+    for (Index i : numbers::range(0, nodes.size()))
+        if (nodes[i].leaf)
+            pending.push_back(i);
+
+    while (!pending.empty())
+    {
+        const Index i = pending.back();
+        pending.pop_back();
+
+        const Index samples = nodes[i].samples.load(std::memory_order_relaxed);
+        if (samples <= maxSamples)
+            continue;
+
+        const int axis = largestAxis(nodes[i].min, nodes[i].max);
+        const Real middle = (nodes[i].min[axis] + nodes[i].max[axis]) / 2;
+
+        for (Index c : numbers::range(0, 2))
+        {
+            Node& child = nodes.emplace_back();
+            const Node& parent = nodes[i];
+            child.min = parent.min;
+            child.max = parent.max;
+            if (c == 0) child.max[axis] = middle;
+            else        child.min[axis] = middle;
+            child.building = parent.building;
+            child.samples.store(samples / 2, std::memory_order_relaxed);
+
+            nodes[i].child[c] = nodes.size() - 1;
+            pending.push_back(nodes.size() - 1);
+        }
+        nodes[i].leaf = false;
+        nodes[i].sampling = DirectionalTree{};
+        nodes[i].building = DirectionalTree{};
+    }
+
+    // Recorded radiance becomes the sampling distribution
+    for (Node& node : nodes)
+    {
+        if (!node.leaf)
+            continue;
+        node.sampling = node.building;
+        node.building = node.sampling.refined(energyThreshold);
+        node.samples.store(0, std::memory_order_relaxed);
+    }
+}
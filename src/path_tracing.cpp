@@ -21,15 +21,27 @@ bool TaskDivider:: getNextTask(Task& task)
 
 PathTracing::Renderer::
 Renderer(const Index numWorkers, const Index queueSize,
-        const TaskDivider& divider, Strategy strategy)
-    : tasks{queueSize}, taskDivider{divider}
+        const TaskDivider& divider, Strategy strategy, Index splitFactor,
+        Real irradianceCacheError, Index guidingTrainingPasses, Real noiseThreshold,
+        Index indirectDownsampling)
+    : queueSize{queueSize}, tasks{queueSize}, taskDivider{divider}, strategy{strategy},
+      guidingPasses{guidingTrainingPasses}, noiseThreshold{noiseThreshold},
+      indirectDownsampling{indirectDownsampling}
 {
+    options.split = splitFactor;
+    if (irradianceCacheError > 0)
+    {
+        irradianceCache = std::make_unique<IrradianceCache>(irradianceCacheError);
+        options.irradianceCache = irradianceCache.get();
+    }
+
     trace = [&]()
     {
         switch (strategy)
         {
         case Strategy::trace_projection:   return traceProjection;
         case Strategy::trace_direct_light: return traceDirectLight;
+        case Strategy::resample_direct_light: return traceDirectLight;
         case Strategy::recursive:          return traceIndirectLightRecursive;
         case Strategy::iterative:          return traceIndirectLightRecursive;
         default:                           return traceIndirectLightRecursive;
@@ -61,14 +73,14 @@ void leaderRoutine(TaskQueue& tasks, TaskDivider& divider)
 }
 
 Color PathTracing::
-traceProjection(const ObjectSet& objSet, const Ray& ray, Randomizer&)
+traceProjection(const ObjectSet& objSet, const Ray& ray, Randomizer&, const TraceOptions&)
 {
     auto [t, hitObj] = findIntersection(objSet, ray);
     return (Ray::isHit(t)) ? hitObj->material().kd() : Color{0, 0, 0};  
 }
 
 Color PathTracing::
-traceDirectLight(const ObjectSet& objSet, const Ray& ray, Randomizer&)
+traceDirectLight(const ObjectSet& objSet, const Ray& ray, Randomizer& random, const TraceOptions&)
 {
     auto [t, hitObj] = findIntersection(objSet, ray);
     if (!Ray::isHit(t))
@@ -76,74 +88,554 @@ traceDirectLight(const ObjectSet& objSet, const Ray& ray, Randomizer&)
 
     Point hit = ray.hitPoint(t);
     auto [from, normal] = hitObj->shape().normal(ray.d, hit);
-    return castShadowRays(objSet, normal, hit, hitObj->material().kd());  
+    return castShadowRays(objSet, normal, hit, hitObj->material().kd(), random);
 }
 
+// `bsdfPdf` is the solid angle density with which a diffuse bounce sampled
+// `ray`, or 0 if it comes from the camera or a specular bounce. It is used to
+// weight area light emission against next event estimation.
+// `firstDiffuse` is true until the path reaches a surface with diffuse
+// component, which is where paths are split and the irradiance cache is used.
+// If `hitDistance` is not null, it is set to the distance `ray` travels to
+// its hit, as findIntersection returns it, so that it is not intersected twice.
 Color traceIndirectLightRecursiveLimited(const ObjectSet& objSet, const Ray& ray,
-        Randomizer& random, const Integer bounces)
+        Randomizer& random, const Integer bounces, const TraceOptions& options,
+        const bool firstDiffuse, const Real bsdfPdf = 0, Real* hitDistance = nullptr)
 {
     if (bounces == 0)
         return Color{};
 
     const auto [t, hitObj] = findIntersection(objSet, ray);
+    if (hitDistance)
+        *hitDistance = t;
 
     if (!Ray::isHit(t))
-        return Color{};
+        return environmentRadiance(objSet, ray, bsdfPdf);
 
     const auto& shape = hitObj->shape();
     const auto& material = hitObj->material();
 
     const auto [emits, emission] = material.emission();
     if (emits)
-        return emission;
+    {
+        if (bsdfPdf <= 0)
+            return emission;
+        const Real lightPdf = areaLightPdf(objSet, shape, ray, t);
+        return emission * powerHeuristic(bsdfPdf, lightPdf);
+    }
 
     const auto hit = ray.hitPoint(t);
     const auto normal = shape.normal(ray.d, hit);
 
-    Ray secondaryRay;
-    const auto [color, k] = material.eval(hit, ray, secondaryRay, normal, random);
+    const bool isDiffuse = material.kd().luminance() > 0;
+    const bool split = firstDiffuse && isDiffuse;
+    const Index paths = split ? options.split : 1;
 
-    if (k == Material::Component::ka)
-        return color;
-
-    const Color indirectLight = traceIndirectLightRecursiveLimited(objSet, secondaryRay, random, bounces - 1);
+    Color cachedIndirect;
+    const bool cached = split && options.irradianceCache;
+    if (cached)
+    {
+        auto radiance = [&](const Ray& r) -> IrradianceCache::RadianceSample
+        {
+            const Real pdf = dot(normal.normal, r.d) / numbers::pi;
+            Real distance = Ray::nohit;
+            const Color radiance = traceIndirectLightRecursiveLimited(objSet, r, random,
+                    bounces - 1, options, false, pdf, &distance);
+            return {radiance, distance};
+        };
+        cachedIndirect = options.irradianceCache->irradiance(hit, normal.normal, radiance, random)
+                       / numbers::pi;
+    }
 
-    if (k == Material::Component::kd)
+    Color sum;
+    for ([[maybe_unused]] Index s : numbers::range(0, paths))
     {
-        const Color directLight = castShadowRays(objSet, normal.normal, hit, material.kd());
-        return indirectLight * color + directLight;
+        Ray secondaryRay;
+        const auto [color, k] = material.eval(hit, ray, secondaryRay, normal, random);
+
+        if (k == Material::Component::ka)
+            continue;
+
+        if (k == Material::Component::kd)
+        {
+            // One-sample mixture of cosine and guided sampling
+            const DirectionalTree* guide = (options.guidingTree && !cached)
+                    ? &options.guidingTree->distribution(hit) : nullptr;
+
+            const Color directLight = castShadowRays(objSet, normal.normal, hit, material.kd(), random)
+                                    + castAreaShadowRay(objSet, normal.normal, hit, color, random, guide)
+                                    + castEnvironmentShadowRay(objSet, normal.normal, hit, color, random, guide);
+            if (cached)
+            {
+                sum = sum + cachedIndirect * color + directLight;
+                continue;
+            }
+
+            Real pdf = dot(normal.normal, secondaryRay.d) / numbers::pi;
+            Color weight = color;
+
+            if (guide)
+            {
+                if (random() < DirectionalTree::guidedFraction)
+                {
+                    const Direction d = guide->sample(normal.normal, random);
+                    secondaryRay = Ray{hit + d * 0.0001, d};
+                }
+
+                const Real cosinePdf = dot(normal.normal, secondaryRay.d) / numbers::pi;
+                pdf = guide->mixturePdf(secondaryRay.d, normal.normal, cosinePdf);
+                weight = color * (cosinePdf / pdf);
+            }
+
+            const Color indirectLight = traceIndirectLightRecursiveLimited(objSet, secondaryRay,
+                    random, bounces - 1, options, !isDiffuse && firstDiffuse, pdf);
+
+            // The tree learns incident radiance times the cosine, which is
+            // proportional to the diffuse integrand
+            if (options.trainGuiding)
+            {
+                const Real cosine = dot(normal.normal, secondaryRay.d);
+                options.guidingTree->record(hit, secondaryRay.d,
+                        indirectLight.luminance() * cosine / pdf);
+            }
+
+            sum = sum + indirectLight * weight + directLight;
+            continue;
+        }
+
+        const Color indirectLight = traceIndirectLightRecursiveLimited(objSet, secondaryRay, random, bounces - 1, options, firstDiffuse && !isDiffuse);
+        sum = sum + indirectLight * color;
     }
     
-    return indirectLight * color;
+    return sum / paths;
 }
 
 Color PathTracing::
 traceIndirectLightRecursive(const ObjectSet& objSet, const Ray& ray,
-        Randomizer& random)
+        Randomizer& random, const TraceOptions& options)
 {
-    return traceIndirectLightRecursiveLimited(objSet, ray, random, -1); /*-1 for unlimited*/
+    return traceIndirectLightRecursiveLimited(objSet, ray, random, maxBounces, options, true);
 }
 
+/* With a `noiseThreshold`, pixels are sampled in rounds and stop as soon as
+   the standard error of the mean of their luminance falls below that
+   fraction of the mean, up to `ppp` samples. The samples taken are added to
+   `samplesTaken`. */
 void workerRoutine(TaskQueue& tasks, Real increment, const Camera& camera,
-        Image& img, const ObjectSet& objects, Index ppp,
-        TextProgressBar& progressBar, TraceFunction trace)
+        Image& img, const ObjectSet& objects, Index ppp, const TraceOptions& options,
+        TextProgressBar& progressBar, TraceFunction trace, Real noiseThreshold,
+        std::atomic<Index>& samplesTaken)
 {
+    constexpr Index roundSamples = 16;
+
     // Each thread has its own unique camera, to avoid critical section
     // at generating random numbers.
     Camera cam {camera};
     Randomizer random {0.0, 1.0};
     Task task {};
+    Index samples = 0;
 
     while (tasks.dequeue(task))
     {
         for (Index i : numbers::range(task.start.i, task.end.i)) //for i = start.i .. end.i
         for (Index j : numbers::range(task.start.j, task.end.j))
+        {
+            Color meanColor {0, 0, 0};
+            Real sum = 0, sumSquares = 0; // of the luminance
+            Index k = 0;
+            while (k < ppp)
+            {
+                const Index round = noiseThreshold > 0
+                        ? numbers::min(roundSamples, ppp - k) : ppp;
+                for ([[maybe_unused]] Index s : numbers::range(0, round))
+                {
+                    Ray ray = cam.randomRay(i, j);
+                    const Color color = trace(objects, ray, random, options);
+                    meanColor = meanColor + color;
+                    sum += color.luminance();
+                    sumSquares += color.luminance() * color.luminance();
+                }
+                k += round;
+
+                // Pixels that have not found any light yet, which may be lit
+                // by a few of their paths, take every sample
+                const Real mean = sum / k;
+                const Real variance = numbers::max(Real(0), sumSquares / k - mean * mean);
+                if (mean > 0 && std::sqrt(variance / k) <= noiseThreshold * mean)
+                    break;
+            }
+            samples += k;
+            // Thread-safe operation: a pixel is not assigned to two different threads 
+            img(i, j) = RGBPixel (meanColor / k);
+        }
+        progressBar.incrementProgress(increment);
+    }
+    samplesTaken += samples;
+}
+
+/* Direct light by reservoir resampling (ReSTIR without temporal reuse). Each
+   pixel of a task resamples a few candidate point lights proportionally to
+   their unshadowed contribution, keeping one of them in a reservoir. Then,
+   reservoirs of neighbouring pixels within the same task are merged, so every
+   pixel benefits from the candidates of its neighbours. Reuse between
+   pixels with different geometry is rejected, but merging does not account
+   for visibility differences, so the estimation is slightly biased. */
+
+struct Reservoir
+{
+    Index light = 0;
+    Real weightSum = 0;
+    Natural candidates = 0;
+    Real weight = 0; // contribution weight of the chosen light
+
+    void update(Index candidate, Real w, Natural count, Randomizer& random)
+    {
+        weightSum += w;
+        candidates += count;
+        if (w > 0 && random() * weightSum < w)
+            light = candidate;
+    }
+};
+
+struct ShadingPoint
+{
+    Point hit;
+    Direction normal;
+    Color kd;
+    Real depth;
+    bool valid = false;
+};
+
+// Unshadowed direct light from `light`, target density of the resampling
+Real targetDensity(const ShadingPoint& sp, const PointLight& light)
+{
+    const Direction d = light.position() - sp.hit;
+    const Real d2 = dot(d, d);
+    const Real term = std::abs(dot(sp.normal, d)) / std::sqrt(d2);
+    return (light.color() * sp.kd).luminance() * term / (d2 * numbers::pi);
+}
+
+void reservoirWorkerRoutine(TaskQueue& tasks, Real increment, const Camera& camera,
+        Image& img, const ObjectSet& objects, Index ppp,
+        TextProgressBar& progressBar)
+{
+    constexpr Index numCandidates = 32;
+    constexpr Index numNeighbors = 5;
+    constexpr Integer neighborRadius = 10; // pixels
+    
+    Camera cam {camera};
+    Randomizer random {0.0, 1.0};
+    Task task {};
+
+    const auto& lights = objects.pointLights;
+    const Index numLights = lights.size();
+
+    std::vector<ShadingPoint> points;
+    std::vector<Reservoir> reservoirs, reused;
+    std::vector<Color> colors;
+
+    while (tasks.dequeue(task))
+    {
+        const Index height = task.end.i - task.start.i;
+        const Index width = task.end.j - task.start.j;
+        const Index size = width * height;
+
+        points.assign(size, {});
+        reservoirs.assign(size, {});
+        reused.assign(size, {});
+        colors.assign(size, {});
+
+        for ([[maybe_unused]] Index k : numbers::range(0, ppp))
+        {
+            // Primary hits and initial candidates
+            for (Index p : numbers::range(0, size))
+            {
+                const Ray ray = cam.randomRay(task.start.i + p / width, task.start.j + p % width);
+                const auto [t, hitObj] = findIntersection(objects, ray);
+
+                ShadingPoint& sp = points[p];
+                Reservoir& r = reservoirs[p];
+                sp.valid = Ray::isHit(t) && numLights > 0;
+                r = Reservoir{};
+                if (!sp.valid)
+                    continue;
+
+                sp.hit = ray.hitPoint(t);
+                sp.normal = hitObj->shape().normal(ray.d, sp.hit).normal;
+                sp.kd = hitObj->material().kd();
+                sp.depth = t;
+
+                for ([[maybe_unused]] Index c : numbers::range(0, numCandidates))
+                {
+                    const Index light = numbers::min(Index(random() * numLights), numLights - 1);
+                    r.update(light, targetDensity(sp, lights[light]) * numLights, 1, random);
+                }
+
+                const Real target = targetDensity(sp, lights[r.light]);
+                if (target > 0)
+                    r.weight = r.weightSum / (r.candidates * target);
+
+                // Occluded samples are not worth sharing
+                const Color direct = castShadowRay(objects, lights[r.light], sp.normal, sp.hit, sp.kd);
+                if (direct.luminance() <= 0)
+                    r.weight = 0;
+            }
+
+            // Spatial reuse
+            for (Index p : numbers::range(0, size))
+            {
+                const ShadingPoint& sp = points[p];
+                Reservoir& r = reused[p];
+                r = Reservoir{};
+                if (!sp.valid)
+                    continue;
+
+                auto merge = [&](const Reservoir& other)
+                {
+                    const Real w = targetDensity(sp, lights[other.light]) * other.weight * other.candidates;
+                    r.update(other.light, w, other.candidates, random);
+                };
+
+                merge(reservoirs[p]);
+                const Integer pi = p / width, pj = p % width;
+                for ([[maybe_unused]] Index n : numbers::range(0, numNeighbors))
+                {
+                    const Integer ni = pi + Integer((2 * random() - 1) * neighborRadius);
+                    const Integer nj = pj + Integer((2 * random() - 1) * neighborRadius);
+                    if (ni < 0 || nj < 0 || ni >= Integer(height) || nj >= Integer(width))
+                        continue;
+
+                    const Index q = ni * width + nj;
+                    const ShadingPoint& other = points[q];
+                    if (q == p || !other.valid
+                        || dot(other.normal, sp.normal) < 0.9
+                        || std::abs(other.depth - sp.depth) > 0.1 * sp.depth)
+                        continue;
+
+                    merge(reservoirs[q]);
+                }
+
+                const Real target = targetDensity(sp, lights[r.light]);
+                if (target > 0)
+                    r.weight = r.weightSum / (r.candidates * target);
+            }
+
+            // Shading with the resampled light
+            for (Index p : numbers::range(0, size))
+            {
+                const ShadingPoint& sp = points[p];
+                const Reservoir& r = reused[p];
+                if (!sp.valid || r.weight <= 0)
+                    continue;
+
+                const Color direct = castShadowRay(objects, lights[r.light], sp.normal, sp.hit, sp.kd);
+                colors[p] = colors[p] + direct * r.weight;
+            }
+        }
+
+        for (Index p : numbers::range(0, size))
+        {
+            // Thread-safe operation: a pixel is not assigned to two different threads 
+            img(task.start.i + p / width, task.start.j + p % width) = RGBPixel (colors[p] / ppp);
+        }
+        progressBar.incrementProgress(increment);
+    }
+}
+
+/* Diffuse indirect light at a lower resolution. Every low resolution pixel
+   averages the incident radiance of cosine-sampled bounces from the first
+   hits of its block of pixels, without their albedo. Full resolution
+   samples multiply it by their own albedo, after interpolating the low
+   resolution pixels around them with a joint bilateral filter: pixels whose
+   hits have a different normal or depth get less weight, so light does not
+   bleed across edges. */
+
+struct IndirectSample
+{
+    Color radiance;   // mean incident radiance
+    Direction normal; // mean normal of the first hits
+    Real depth = 0;   // mean distance of the first hits
+    bool valid = false;
+};
+
+struct IndirectBuffer
+{
+    struct Dimensions { Index width, height; };
+
+    std::vector<IndirectSample>& samples;
+    Dimensions dim;
+    Index factor; // full resolution pixels per side of a low resolution pixel
+
+    inline IndirectSample& operator()(Index i, Index j) { return samples[i * dim.width + j]; }
+
+    inline const IndirectSample& operator()(Index i, Index j) const { return samples[i * dim.width + j]; }
+
+    // Interpolated incident radiance at a first hit of full resolution
+    // pixel (i, j), with `normal` and at `depth`
+    Color upsample(Index i, Index j, const Direction& normal, Real depth) const
+    {
+        constexpr Real normalExponent = 8;
+        constexpr Real depthTolerance = 0.1; // relative
+
+        // Position among the centres of the low resolution pixels
+        const Real y = (i + Real(0.5)) / factor - Real(0.5);
+        const Real x = (j + Real(0.5)) / factor - Real(0.5);
+        const Real i0 = std::floor(y), j0 = std::floor(x);
+
+        Color sum, fallback;
+        Real weightSum = 0, fallbackSum = 0;
+        for (int di : {0, 1})
+        for (int dj : {0, 1})
+        {
+            const Index li = numbers::min(Index(numbers::max(i0 + di, Real(0))), dim.height - 1);
+            const Index lj = numbers::min(Index(numbers::max(j0 + dj, Real(0))), dim.width - 1);
+            const IndirectSample& s = (*this)(li, lj);
+            if (!s.valid)
+                continue;
+
+            const Real bilinear = (di ? y - i0 : 1 - (y - i0))
+                                * (dj ? x - j0 : 1 - (x - j0)) + Real(0.001);
+            const Real similarity =
+                    std::pow(numbers::max(dot(normal, s.normal), Real(0)), normalExponent)
+                  * std::exp(-std::abs(depth - s.depth) / (depthTolerance * depth));
+
+            sum = sum + s.radiance * (bilinear * similarity);
+            weightSum += bilinear * similarity;
+            fallback = fallback + s.radiance * bilinear;
+            fallbackSum += bilinear;
+        }
+
+        if (weightSum > 0)
+            return sum / weightSum;
+        // None of them looks like this hit, interpolate them anyway
+        return fallbackSum > 0 ? fallback / fallbackSum : Color{};
+    }
+};
+
+void indirectWorkerRoutine(TaskQueue& tasks, Real increment, const Camera& camera,
+        const ObjectSet& objects, Index ppp, const TraceOptions& options,
+        IndirectBuffer& buffer, TextProgressBar& progressBar)
+{
+    Camera cam {camera};
+    Randomizer random {0.0, 1.0};
+    Task task {};
+
+    const Index factor = buffer.factor;
+    const Index height = buffer.dim.height * factor, width = buffer.dim.width * factor;
+
+    while (tasks.dequeue(task))
+    {
+        for (Index i : numbers::range(task.start.i, task.end.i))
+        for (Index j : numbers::range(task.start.j, task.end.j))
+        {
+            Color radiance;
+            Direction normal, firstNormal;
+            Real depth = 0;
+            Index count = 0;
+            for ([[maybe_unused]] Index k : numbers::range(0, ppp))
+            {
+                // Any pixel of the block, the image may not be a multiple of it
+                const Index fi = i * factor + Index(random() * factor);
+                const Index fj = j * factor + Index(random() * factor);
+                if (fi >= height || fj >= width)
+                    continue;
+
+                const Ray ray = cam.randomRay(fi, fj);
+                const auto [t, hitObj] = findIntersection(objects, ray);
+                if (!Ray::isHit(t))
+                    continue;
+
+                const auto& material = hitObj->material();
+                if (material.emission().emits || material.kd().luminance() <= 0)
+                    continue;
+
+                const auto hit = ray.hitPoint(t);
+                const auto n = hitObj->shape().normal(ray.d, hit);
+                const Ray bounce = material.sampleAll(hit, ray, n, random).rd;
+                const Real pdf = dot(n.normal, bounce.d) / numbers::pi;
+
+                radiance = radiance + traceIndirectLightRecursiveLimited(objects, bounce,
+                        random, maxBounces, options, false, pdf);
+                if (count == 0)
+                    firstNormal = n.normal;
+                normal = normal + n.normal;
+                depth += t;
+                count++;
+            }
+
+            // Opposite normals, as on both sides of a thin object, may cancel
+            // out and have no direction, so the first one is kept instead
+            const Real length = norm(normal);
+            if (count > 0)
+                buffer(i, j) = {radiance / count,
+                                length > Real(1e-3) * count ? normal / length : firstNormal,
+                                depth / count, true};
+            else
+                buffer(i, j) = {};
+        }
+        progressBar.incrementProgress(increment);
+    }
+}
+
+/* Full resolution pass of the downsampled mode. Direct light and light
+   through specular and refractive components are traced at every sample,
+   diffuse indirect light is read from `buffer`. */
+void upsampleWorkerRoutine(TaskQueue& tasks, Real increment, const Camera& camera,
+        Image& img, const ObjectSet& objects, Index ppp, const TraceOptions& options,
+        const IndirectBuffer& buffer, TextProgressBar& progressBar)
+{
+    Camera cam {camera};
+    Randomizer random {0.0, 1.0};
+    Task task {};
+
+    while (tasks.dequeue(task))
+    {
+        for (Index i : numbers::range(task.start.i, task.end.i))
+        for (Index j : numbers::range(task.start.j, task.end.j))
         {
             Color meanColor {0, 0, 0};
             for ([[maybe_unused]] Index k : numbers::range(0, ppp))
             {
-                Ray ray = cam.randomRay(i, j);
-                meanColor = meanColor + trace(objects, ray, random);
+                const Ray ray = cam.randomRay(i, j);
+                const auto [t, hitObj] = findIntersection(objects, ray);
+                if (!Ray::isHit(t))
+                {
+                    meanColor = meanColor + environmentRadiance(objects, ray);
+                    continue;
+                }
+
+                const auto& material = hitObj->material();
+                const auto [emits, emission] = material.emission();
+                if (emits)
+                {
+                    meanColor = meanColor + emission;
+                    continue;
+                }
+
+                const auto hit = ray.hitPoint(t);
+                const auto normal = hitObj->shape().normal(ray.d, hit);
+
+                const Color kd = material.kd();
+                if (kd.luminance() > 0)
+                {
+                    meanColor = meanColor
+                              + castShadowRays(objects, normal.normal, hit, kd, random)
+                              + castAreaShadowRay(objects, normal.normal, hit, kd, random)
+                              + castEnvironmentShadowRay(objects, normal.normal, hit, kd, random)
+                              + kd * buffer.upsample(i, j, normal.normal, t);
+                }
+
+                // One of the specular and refractive components
+                const Real ps = material.ks().luminance(), pt = material.kt().luminance();
+                if (ps + pt <= 0)
+                    continue;
+
+                const auto rays = material.sampleAll(hit, ray, normal, random);
+                const bool specular = random() * (ps + pt) < ps;
+                const Color weight = specular ? material.ks() * ((ps + pt) / ps)
+                                              : material.kt() * ((ps + pt) / pt);
+                meanColor = meanColor + weight * traceIndirectLightRecursiveLimited(objects,
+                        specular ? rays.rs : rays.rt, random, maxBounces, options, false);
             }
             // Thread-safe operation: a pixel is not assigned to two different threads 
             img(i, j) = RGBPixel (meanColor / ppp);
@@ -153,28 +645,21 @@ void workerRoutine(TaskQueue& tasks, Real increment, const Camera& camera,
 }
 
 void PathTracing::Renderer::
-render(const Camera& cam, Image& img,
-        const ObjectSet& objects, Index ppp)
+runPass(TaskQueue& queue, TaskDivider& divider, std::string_view message,
+        const WorkerLauncher& launch)
 {
-    std::cout << "Algorithm: path tracing\n";
-    std::cout << "Worker pool size: " << numThreads() << "\n\n";
-
-    const Real totalSize = taskDivider.width * taskDivider.height;
-    const Real regionSize = taskDivider.regionWidth * taskDivider.regionHeight;
+    const Real totalSize = divider.width * divider.height;
+    const Real regionSize = divider.regionWidth * divider.regionHeight;
     const Real increment = regionSize / totalSize;
 
     TextProgressBar progressBar {std::cout};
 
     leader = std::thread(leaderRoutine, 
-            std::ref(tasks), std::ref(taskDivider));
+            std::ref(queue), std::ref(divider));
     for (auto& worker : threadPool)
-    {
-        worker = std::thread(workerRoutine, std::ref(tasks), increment,
-                std::ref(cam), std::ref(img), std::ref(objects), ppp,
-                std::ref(progressBar), trace);
-    }
+        worker = launch(increment, progressBar);
 
-    std::cout << "Rendering...\n";
+    std::cout << message << "...\n";
     progressBar.launch(true);
 
     leader.join();
@@ -183,6 +668,126 @@ render(const Camera& cam, Image& img,
 
     progressBar.stop();
     progressBar.join();
+}
+
+void PathTracing::Renderer::
+renderPass(const Camera& cam, Image& img, const ObjectSet& objects, Index ppp,
+        TaskQueue& queue, TaskDivider& divider, std::string_view message)
+{
+    runPass(queue, divider, message, [&](Real increment, TextProgressBar& progressBar)
+    {
+        if (strategy == Strategy::resample_direct_light)
+        {
+            return std::thread(reservoirWorkerRoutine, std::ref(queue), increment,
+                    std::ref(cam), std::ref(img), std::ref(objects), ppp,
+                    std::ref(progressBar));
+        }
+        return std::thread(workerRoutine, std::ref(queue), increment,
+                std::ref(cam), std::ref(img), std::ref(objects), ppp,
+                std::cref(options), std::ref(progressBar), trace,
+                noiseThreshold, std::ref(samplesTaken));
+    });
+}
+
+void PathTracing::Renderer::
+renderDownsampled(const Camera& cam, Image& img, const ObjectSet& objects, Index ppp)
+{
+    const Index factor = indirectDownsampling;
+    const Index width = taskDivider.width, height = taskDivider.height;
+    const IndirectBuffer::Dimensions lowDim {(width + factor - 1) / factor,
+                                             (height + factor - 1) / factor};
+
+    std::vector<IndirectSample> samples(lowDim.width * lowDim.height);
+    IndirectBuffer buffer {samples, lowDim, factor};
+
+    TaskQueue lowTasks {queueSize};
+    TaskDivider lowDivider {{lowDim.width, lowDim.height},
+                            {taskDivider.regionWidth, taskDivider.regionHeight}};
+    const std::string message = "Tracing indirect light at 1/"
+            + std::to_string(factor) + " resolution";
+    runPass(lowTasks, lowDivider, message, [&](Real increment, TextProgressBar& progressBar)
+    {
+        return std::thread(indirectWorkerRoutine, std::ref(lowTasks), increment,
+                std::ref(cam), std::ref(objects), ppp, std::cref(options),
+                std::ref(buffer), std::ref(progressBar));
+    });
+
+    runPass(tasks, taskDivider, "Rendering", [&](Real increment, TextProgressBar& progressBar)
+    {
+        return std::thread(upsampleWorkerRoutine, std::ref(tasks), increment,
+                std::ref(cam), std::ref(img), std::ref(objects), ppp,
+                std::cref(options), std::cref(buffer), std::ref(progressBar));
+    });
+}
+
+void PathTracing::Renderer::
+render(const Camera& cam, Image& img,
+        const ObjectSet& objects, Index ppp)
+{
+    std::cout << "Algorithm: path tracing\n";
+    std::cout << "Worker pool size: " << numThreads() << "\n\n";
+
+    if (irradianceCache)
+        irradianceCache->setView(cam);
+
+    if (guidingPasses > 0)
+    {
+        // Bounds of the spatial tree, from a grid of primary hits
+        constexpr Index grid = 32;
+        Camera c {cam};
+        Point min, max;
+        bool first = true;
+        for (Index i : numbers::range(0, grid))
+        for (Index j : numbers::range(0, grid))
+        {
+            const Ray ray = c.randomRay(i * taskDivider.height / grid, j * taskDivider.width / grid);
+            const auto [t, hitObj] = findIntersection(objects, ray);
+            if (!Ray::isHit(t))
+                continue;
+
+            const Point hit = ray.hitPoint(t);
+            for (int a = 0; a < 3; a++)
+            {
+                min[a] = first ? hit[a] : numbers::min(min[a], hit[a]);
+                max[a] = first ? hit[a] : numbers::max(max[a], hit[a]);
+            }
+            first = false;
+        }
+
+        guidingTree = std::make_unique<GuidingTree>(min, max);
+        options.guidingTree = guidingTree.get();
+        options.trainGuiding = true;
+
+        // Training passes double their samples, their images are discarded
+        for (Index pass : numbers::range(0, guidingPasses))
+        {
+            TaskQueue passTasks {queueSize};
+            TaskDivider passDivider {taskDivider};
+            const std::string message = "Training path guiding (pass "
+                    + std::to_string(pass + 1) + "/" + std::to_string(guidingPasses) + ")";
+            renderPass(cam, img, objects, Index(1) << pass, passTasks, passDivider, message);
+            guidingTree->refine(pass);
+        }
+
+        options.trainGuiding = false;
+        std::cout << "Guiding tree: " << guidingTree->size() << " spatial nodes\n";
+    }
+
+    samplesTaken = 0;
+    if (indirectDownsampling > 1)
+        renderDownsampled(cam, img, objects, ppp);
+    else
+        renderPass(cam, img, objects, ppp, tasks, taskDivider, "Rendering");
+
+    if (noiseThreshold > 0 && strategy != Strategy::resample_direct_light
+        && indirectDownsampling <= 1)
+    {
+        std::cout << "Mean samples per pixel: "
+                  << Real(samplesTaken) / (taskDivider.width * taskDivider.height) << '\n';
+    }
+
+    if (irradianceCache)
+        std::cout << "Irradiance cache records: " << irradianceCache->size() << '\n';
 
     img.updateLuminance();
 }
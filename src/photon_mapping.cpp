@@ -1,5 +1,10 @@
 #include "photon_mapping.hpp"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <optional>
+
 using namespace PhotonMapping;
 
 bool TaskDivider:: getNextTask(Task& task)
@@ -48,71 +53,172 @@ void leaderRoutine(TaskQueue& tasks, TaskDivider& divider)
     tasks.stop(); // Tell threads not to block if queue is empty, but to quit
 }
 
+// Index of `object` in the scene, which identifies it in an SPhoton
+Index objectIndex(const ObjectSet& objSet, const Object* object)
+{
+    return object - objSet.objects.data();
+}
+
+/* Follows a light path carrying `flux`, saving photons in `photonRegister` at
+   the `hits` diffuse hits, after the first one unless `save`. Photons carry
+   the flux that arrives at their hit, and are saved at every surface with a
+   diffuse component before the roulette picks one, so that they are not
+   weighted by its probability, and every map reads them the same way.
+   Caustic paths end at diffuse bounces. */
 template<typename PhotonTy>
-void castPhotonToScene(const ObjectSet& objSet, const Ray& ray,
-        PhotonTy photon, std::vector<PhotonTy>& photonRegister,
-        Randomizer& random, Index total, Index& mapped, bool save)
+void castPhotonToScene(const ObjectSet& objSet, Ray ray, Color flux,
+        std::vector<PhotonTy>& photonRegister, Randomizer& random, bool save,
+        PhotonHits hits)
 {
-    if (mapped == total)
-        return;
-    
-    const auto [t, hitObj] = findIntersection(objSet, ray);
+    bool caustic = false; // The path only has specular or refractive bounces
 
-    if (!Ray::isHit(t))
-        return;
+    auto deposit = [&](const Point& hit, const Color& saved, const Object* hitObj)
+    {
+        if constexpr (std::same_as<PhotonTy, SPhoton>)
+            photonRegister.emplace_back(hit, saved, ray.d, objectIndex(objSet, hitObj));
+        else
+            photonRegister.emplace_back(hit, saved, ray.d);
+    };
 
-    const auto& shape = hitObj->shape();
-    const auto& material = hitObj->material();
+    for (Index bounce : numbers::range(0, maxBounces))
+    {
+        const auto [t, hitObj] = findIntersection(objSet, ray);
 
-    const auto hit = ray.hitPoint(t);
-    const auto normal = shape.normal(ray.d, hit);
+        if (!Ray::isHit(t))
+            return;
 
-    Ray secondaryRay;
-    const auto [color, k] = material.eval(hit, ray, secondaryRay, normal, random);
+        const auto& shape = hitObj->shape();
+        const auto& material = hitObj->material();
 
-    switch(k)
-    {
-    case Material::Component::ka:
-        break; // don't save and leave
-    case Material::Component::ks:
-    case Material::Component::kt:
-        castPhotonToScene<PhotonTy>(objSet, secondaryRay, photon,
-                photonRegister, random, total, mapped, true);
-        break;
-    case Material::Component::kd:
-        if (save)
+        const auto hit = ray.hitPoint(t);
+        const auto normal = shape.normal(ray.d, hit);
+
+        if (material.kd().luminance() > 0
+                && (hits == PhotonHits::caustics ? caustic
+                    : save && (hits == PhotonHits::all || !caustic)))
+            deposit(hit, flux, hitObj);
+
+        Ray secondaryRay;
+        const auto [color, k] = material.eval(hit, ray, secondaryRay, normal, random);
+
+        switch(k)
         {
-            Real lat = std::acos(ray.d[0]);
-            if (ray.d[2] < 0)
-                lat = -lat;
-
-            Real az = std::acos(ray.d[1] / std::sin(lat));
-            if (ray.d[0] < 0)
-                az = -az;
-            
-            if constexpr (std::same_as<PhotonTy, SPhoton>)
-                photonRegister.emplace_back(hit, photon.flux * color, lat, az, &shape);
-            else
-                photonRegister.emplace_back(hit, photon.flux * color, lat, az);
-            mapped++;
+        case Material::Component::ka:
+            return; // don't save and leave
+        case Material::Component::ks:
+        case Material::Component::kt:
+            flux = flux * color;
+            caustic = bounce == 0 || caustic;
+            break;
+        case Material::Component::kd:
+            if (hits == PhotonHits::caustics)
+                return;
+
+            flux = flux * color;
+            caustic = false;
+            break;
         }
 
-        photon.flux = photon.flux * color;
-        castPhotonToScene<PhotonTy>(objSet, secondaryRay, photon, photonRegister,
-                random, total, mapped, true);
-        break;
+        save = true;
+        ray = secondaryRay;
     }
 }
 
-template<typename PhotonTy>
+// Box kernel estimate of the light reflected at `hit`, on the object with
+// index `object`, by a surface with diffuse coefficient `kd`, from the
+// `numPhotons` nearest photons within `radius`. Neither query allocates, as
+// this runs for every diffuse hit.
+template<typename PhotonTy, typename MapTy>
+Color estimateRadiance(const MapTy& map, const Point& hit,
+        Index object, const Color& kd, Real radius, Index numPhotons)
+{
+    Color sum;
+    auto add = [&](const PhotonTy& photon)
+    {
+        if constexpr (std::same_as<PhotonTy, SPhoton>)
+            if (photon.object != object) // Only sum photons on the same object
+                return;
+        sum = sum + Color(photon.flux) * kd;
+    };
+
+    if (numPhotons >= map.size())
+    {
+        // All the photons within the radius are summed, so they need no sorting
+        map.for_each_in_radius(hit, radius,
+                [&](const PhotonTy& photon, Real) { add(photon); });
+    }
+    else
+    {
+        // Storage for the nearest photons, reused by all queries of the thread
+        thread_local std::vector<typename MapTy::neighbor> nearest;
+        nearest.resize(numPhotons);
+
+        const Index found = map.nearest_neighbors(hit, std::span{nearest}, radius);
+        for (Index i : numbers::range(0, found))
+            add(*nearest[i].element);
+    }
+    return sum / (radius * radius * numbers::pi * numbers::pi);
+}
+
+/* Replaces the flux of `points`, photons of `map`, with the light that a
+   white surface reflects at them, as estimateRadiance reads it from `map`.
+   Worker `first` of `step` takes the points `first`, `first + step`... */
+template<typename PhotonTy, typename MapTy>
+void precomputeRoutine(Index first, Index step, const MapTy& map,
+        std::vector<PhotonTy>& points, Real radius, Index numPhotons)
+{
+    for (Index i = first; i < points.size(); i += step)
+    {
+        Index object = 0;
+        if constexpr (std::same_as<PhotonTy, SPhoton>)
+            object = points[i].object;
+        points[i].flux = PackedFlux{estimateRadiance<PhotonTy>(map,
+                points[i].position, object, Color{1, 1, 1}, radius, numPhotons)};
+    }
+}
+
+// Light reflected at `hit`, on the object with index `object`, by a surface
+// with diffuse coefficient `kd`, read from the nearest of the `points` that
+// precomputeRoutine estimated within `radius` (on the same object, for
+// SPhotons). A single query, against the many photons of estimateRadiance.
+// Nothing if there is no such point.
+template<typename PhotonTy, typename MapTy>
+std::optional<Color> lookupIrradiance(const MapTy& points, const Point& hit,
+        Index object, const Color& kd, Real radius)
+{
+    // A few candidates, in case the nearest ones are on other objects
+    constexpr Index candidates = std::same_as<PhotonTy, SPhoton> ? 8 : 1;
+    std::array<typename MapTy::neighbor, candidates> nearest;
+
+    const Index found = points.nearest_neighbors(hit, std::span{nearest}, radius);
+    const typename MapTy::neighbor* closest = nullptr;
+    for (Index i : numbers::range(0, found))
+    {
+        if constexpr (std::same_as<PhotonTy, SPhoton>)
+            if (nearest[i].element->object != object)
+                continue;
+        if (!closest || nearest[i].squared_distance < closest->squared_distance)
+            closest = &nearest[i];
+    }
+    if (!closest)
+        return std::nullopt;
+    return Color(closest->element->flux) * kd;
+}
+
+// `estimate(hit, normal, object, kd, random)` reads the light reflected at
+// diffuse hits from the photon maps, as estimateRadiance does
+template<typename Estimate>
 Color castRayToScene(const ObjectSet& objSet, const Ray& ray,
-        const PhotonMap<PhotonTy>& map, Randomizer& random, Real radius,
-        Index numPhotons, bool nextEvent, bool russianRoulette)
+        const Estimate& estimate, Randomizer& random, bool nextEvent,
+        bool russianRoulette, Index bounce = 0)
 {
+    if (bounce == maxBounces)
+        return Color{};
+
     const auto [t, hitObj] = findIntersection(objSet, ray);
 
     if (!Ray::isHit(t))
-        return Color{};
+        return environmentRadiance(objSet, ray);
 
     const auto& shape = hitObj->shape();
     const auto& material = hitObj->material();
@@ -133,24 +239,11 @@ Color castRayToScene(const ObjectSet& objSet, const Ray& ray,
         {
         case Material::Component::ks:
         case Material::Component::kt:
-            return castRayToScene<PhotonTy>(objSet, secondaryRay, map, random, radius, numPhotons, nextEvent, russianRoulette);
+            return castRayToScene(objSet, secondaryRay, estimate, random, nextEvent, russianRoulette, bounce + 1);
         case Material::Component::ka:
         case Material::Component::kd:
-            auto nearest = map.nearest_neighbors(hit, numPhotons, radius);
-            
-            // Estimation using box kernel
-            Color sum;
-            Index count = 0;
-            for (const PhotonTy* photon : nearest)
-            {
-                if constexpr (std::same_as<PhotonTy, SPhoton>)
-                    if (photon->shape != &shape) // Only sum photons on the same object
-                        continue;
-                sum = sum + photon->flux * material.kd();
-                count++;
-            }
-            sum = sum / (radius * radius * numbers::pi * numbers::pi);
-            return sum;
+            return estimate(hit, normal.normal, objectIndex(objSet, hitObj),
+                            material.kd(), random);
         }
     }
     //--------------------------------------------------------------------------
@@ -159,39 +252,95 @@ Color castRayToScene(const ObjectSet& objSet, const Ray& ray,
 
     // Always exit out of transmisor if ray hits from inside
     if (normal.side == Shape::Side::in)
-        return castRayToScene<PhotonTy>(objSet, rt, map, random, radius, numPhotons, nextEvent, russianRoulette);
+        return castRayToScene(objSet, rt, estimate, random, nextEvent, russianRoulette, bounce + 1);
 
     Color cd, cs, ct;
     if (ps > 0.001)
-        cs = castRayToScene<PhotonTy>(objSet, rs, map, random, radius, numPhotons, nextEvent, russianRoulette);
+        cs = castRayToScene(objSet, rs, estimate, random, nextEvent, russianRoulette, bounce + 1);
     if (pt > 0.001)
-        ct = castRayToScene<PhotonTy>(objSet, rt, map, random, radius, numPhotons, nextEvent, russianRoulette);
+        ct = castRayToScene(objSet, rt, estimate, random, nextEvent, russianRoulette, bounce + 1);
 
     if (pd > 0.001)
     {
-        auto nearest = map.nearest_neighbors(hit, numPhotons, radius);
-
-        for (const PhotonTy* photon : nearest)
-        {
-            if constexpr (std::same_as<PhotonTy, SPhoton>)
-                if (photon->shape != &shape)
-                    continue;
-            cd = cd + photon->flux * material.kd();
-        }
-        cd = cd / (radius * radius * numbers::pi * numbers::pi);
+        cd = estimate(hit, normal.normal, objectIndex(objSet, hitObj),
+                      material.kd(), random);
 
         if (nextEvent) 
-            cd = cd + castShadowRays(objSet, normal.normal, hit, material.kd());
+            cd = cd + castShadowRays(objSet, normal.normal, hit, material.kd(), random);
     }
     
     return (cd * pd) + (cs * ps) + (ct * pt);
 }
 
-template<typename PhotonTy>
+/* Hybrid estimator: direct light and diffuse interreflections are path
+   traced, and the caustic photon map only adds the light that reaches each
+   diffuse hit through specular or refractive bounces from a point light,
+   which shadow rays cannot find. Caustics from area lights and the
+   environment are found by the path itself when it hits them. */
+template<typename Estimate>
+Color castHybridRayToScene(const ObjectSet& objSet, Ray ray,
+        const Estimate& estimate, Randomizer& random)
+{
+    Color color {0, 0, 0};
+    Color throughput {1, 1, 1};
+    Real bsdfPdf = 0; // 0 after specular bounces, which light sampling can't follow
+
+    for ([[maybe_unused]] Index bounce : numbers::range(0, maxBounces))
+    {
+        const auto [t, hitObj] = findIntersection(objSet, ray);
+
+        if (!Ray::isHit(t))
+        {
+            color = color + throughput * environmentRadiance(objSet, ray, bsdfPdf);
+            break;
+        }
+
+        const auto& shape = hitObj->shape();
+        const auto& material = hitObj->material();
+
+        const auto [emits, emission] = material.emission();
+        if (emits)
+        {
+            const Real weight = bsdfPdf <= 0 ? 1
+                    : powerHeuristic(bsdfPdf, areaLightPdf(objSet, shape, ray, t));
+            color = color + throughput * emission * weight;
+            break;
+        }
+
+        const auto hit = ray.hitPoint(t);
+        const auto normal = shape.normal(ray.d, hit);
+
+        Ray secondaryRay;
+        const auto [weight, k] = material.eval(hit, ray, secondaryRay, normal, random);
+
+        if (k == Material::Component::ka)
+            break;
+
+        if (k == Material::Component::kd)
+        {
+            const Color kd = throughput * weight;
+            color = color
+                  + castShadowRays(objSet, normal.normal, hit, kd, random)
+                  + castAreaShadowRay(objSet, normal.normal, hit, kd, random)
+                  + castEnvironmentShadowRay(objSet, normal.normal, hit, kd, random)
+                  + estimate(hit, normal.normal, objectIndex(objSet, hitObj), kd, random);
+            bsdfPdf = dot(normal.normal, secondaryRay.d) / numbers::pi;
+        }
+        else
+            bsdfPdf = 0;
+
+        throughput = throughput * weight;
+        ray = secondaryRay;
+    }
+
+    return color;
+}
+
+template<typename Estimate>
 void workerRoutine(TaskQueue& tasks, Real increment, const Camera& camera,
-        Image& img, const ObjectSet& objects, Index ppp, Real radius, Index numPhotons,
-        const PhotonMap<PhotonTy>& map, TextProgressBar& progressBar,
-        bool nextEvent, bool russianRoulette)
+        Image& img, const ObjectSet& objects, Index ppp, const Estimate& estimate,
+        TextProgressBar& progressBar, bool nextEvent, bool russianRoulette,
+        bool hybrid)
 {
     Camera cam {camera};
     Randomizer random {0.0, 1.0};
@@ -206,10 +355,13 @@ void workerRoutine(TaskQueue& tasks, Real increment, const Camera& camera,
             for ([[maybe_unused]] Index k : numbers::range(0, ppp))
             {
                 Ray ray = cam.randomRay(i, j);
-                meanColor = meanColor
-                          + castRayToScene<PhotonTy>(objects, ray, map, random,
-                                                     radius, numPhotons,
-                                                     nextEvent, russianRoulette);
+                if (hybrid)
+                    meanColor = meanColor
+                              + castHybridRayToScene(objects, ray, estimate, random);
+                else
+                    meanColor = meanColor
+                              + castRayToScene(objects, ray, estimate, random,
+                                               nextEvent, russianRoulette);
             }
             // Thread-safe operation: a pixel is not assigned to two different threads 
             img(i, j) = RGBPixel (meanColor / ppp);
@@ -218,20 +370,143 @@ void workerRoutine(TaskQueue& tasks, Real increment, const Camera& camera,
     }
 }
 
-std::vector<Index> dividePhotonsByPower(const ObjectSet& objSet, Index total)
+// First diffuse hit of a camera path, where stochastic progressive photon
+// mapping reads the photons of an iteration
+struct VisiblePoint
+{
+    Point position;
+    Index object;
+    Color weight; // Reflectance of the hit times the throughput of the path
+};
+
+/* Follows the camera `ray` through specular and refractive bounces to its
+   visible point, if it finds one. Returns the light that does not come from
+   the photons: the environment, if the path misses the scene, and the direct
+   light at the visible point with `nextEvent`. */
+Color traceVisiblePoint(const ObjectSet& objSet, Ray ray, Randomizer& random,
+        bool nextEvent, std::optional<VisiblePoint>& point)
 {
-    const auto& lights = objSet.pointLights;
-    const Index numLights = lights.size();
+    point.reset();
+    Color throughput {1, 1, 1};
+
+    for ([[maybe_unused]] Index bounce : numbers::range(0, maxBounces))
+    {
+        const auto [t, hitObj] = findIntersection(objSet, ray);
+
+        if (!Ray::isHit(t))
+            return throughput * environmentRadiance(objSet, ray);
+
+        const auto& shape = hitObj->shape();
+        const auto& material = hitObj->material();
+
+        const auto hit = ray.hitPoint(t);
+        const auto normal = shape.normal(ray.d, hit);
+
+        Ray secondaryRay;
+        const auto [weight, k] = material.eval(hit, ray, secondaryRay, normal, random);
+
+        switch (k)
+        {
+        case Material::Component::ka:
+            return Color{};
+        case Material::Component::ks:
+        case Material::Component::kt:
+            throughput = throughput * weight;
+            break;
+        case Material::Component::kd:
+            point = VisiblePoint{hit, objectIndex(objSet, hitObj), throughput * weight};
+            return nextEvent
+                    ? castShadowRays(objSet, normal.normal, hit, point->weight, random)
+                    : Color{};
+        }
+
+        ray = secondaryRay;
+    }
+
+    return Color{};
+}
+
+// What a pixel has read over the iterations of progressive photon mapping
+struct PixelStatistics
+{
+    Real radius2;   // Squared radius of its photons
+    Real photons;   // Photons within the radius
+    Color flux;     // Reflected flux of those photons
+    Color direct;   // Sum of the light of the iterations not read from photons
+};
+
+/* An iteration of progressive photon mapping over the rows `first`,
+   `first + step`... of the image: a new visible point per pixel reads the
+   photons of `map` within the radius of the pixel, of which it keeps a
+   fraction `alpha` and shrinks the radius to match [Hachisuka and Jensen
+   2009]. */
+template<typename PhotonTy, typename MapTy>
+void progressiveWorkerRoutine(Index first, Index step, const Camera& camera,
+        const ObjectSet& objects, const MapTy& map,
+        std::vector<PixelStatistics>& pixels, Index width, Index height,
+        bool nextEvent)
+{
+    constexpr Real alpha = 0.7;
+
+    Camera cam {camera};
+    Randomizer random {0.0, 1.0};
+    std::optional<VisiblePoint> point;
+
+    for (Index i = first; i < height; i += step)
+    for (Index j : numbers::range(0, width))
+    {
+        PixelStatistics& pixel = pixels[i * width + j];
+        pixel.direct = pixel.direct + traceVisiblePoint(objects, cam.randomRay(i, j),
+                                                        random, nextEvent, point);
+        if (!point)
+            continue;
+
+        Real found = 0;
+        Color flux;
+        map.for_each_in_radius(point->position, std::sqrt(pixel.radius2),
+                [&](const PhotonTy& photon, Real)
+                {
+                    if constexpr (std::same_as<PhotonTy, SPhoton>)
+                        if (photon.object != point->object) // Only photons on the same object
+                            return;
+                    found++;
+                    flux = flux + Color(photon.flux);
+                });
+        if (found == 0)
+            continue;
+
+        const Real photons = pixel.photons + alpha * found;
+        const Real shrink = photons / (pixel.photons + found);
+        pixel.radius2 = pixel.radius2 * shrink;
+        pixel.flux = (pixel.flux + flux * point->weight / numbers::pi) * shrink;
+        pixel.photons = photons;
+    }
+}
+
+// Photons of every point light, and of the environment last if
+// `environment`, proportionally to their power
+std::vector<Index> dividePhotonsByPower(const ObjectSet& objSet, Index total,
+        bool environment)
+{
+    std::vector<Real> powers;
+    for (const auto& light : objSet.pointLights)
+        powers.push_back(4 * numbers::pi * light.color().luminance());
+    if (environment)
+        powers.push_back(objSet.environment->power());
+
+    const Index numLights = powers.size();
     std::vector<Index> photonsPerLight(numLights);
+    if (numLights == 0)
+        return photonsPerLight;
 
     Real sumOfPower = 0;
-    for (const auto& light : lights)
-        sumOfPower += light.color().luminance();
+    for (Real power : powers)
+        sumOfPower += power;
     
     Integer sum = 0;
     for (Index i : numbers::range(0, numLights))
     {
-        photonsPerLight[i] = lights[i].color().luminance() / sumOfPower;
+        photonsPerLight[i] = total * (powers[i] / sumOfPower);
         sum += photonsPerLight[i];
     }
         
@@ -255,15 +530,146 @@ std::vector<Index> dividePhotonsByPower(const ObjectSet& objSet, Index total)
     return photonsPerLight;
 }   
 
+/* Samples the first ray of a light path from point light `i` of the scene,
+   or from the environment if it is past the last one, and the `flux` it
+   carries. Returns false if the environment cannot emit any. */
+bool emitPhoton(const ObjectSet& objects, Index i, Ray& ray, Color& flux,
+        Randomizer& random)
+{
+    if (i == objects.pointLights.size())
+    {
+        // From a disk facing the sampled direction, as wide as the scene
+        const auto& env = *objects.environment;
+        const auto [d, radiance, pdf] = env.sample(random);
+        const Real radius = env.radius();
+        if (pdf <= 0)
+            return false;
+        flux = radiance * (numbers::pi * radius * radius / pdf);
+
+        const Direction u = normalize(std::abs(d[0]) < 0.9
+                ? cross(d, Direction{1, 0, 0}) : cross(d, Direction{0, 1, 0}));
+        const Direction v = cross(d, u);
+        const Real r = radius * std::sqrt(random());
+        const Real a = 2 * numbers::pi * random();
+        const Point origin = Point{0, 0, 0} + d * radius
+                           + u * (r * std::cos(a)) + v * (r * std::sin(a));
+        ray = Ray{origin, d * -1};
+        return true;
+    }
+
+    const auto& light = objects.pointLights[i];
+    flux = 4 * numbers::pi * light.color();
+
+    const Real cosLat = 2 * random() - 1;
+    const Real sinLat = std::sqrt(1 - cosLat * cosLat);
+    const Real az = 2 * numbers::pi * random();
+
+    const Direction dir { sinLat * std::sin(az),
+                          cosLat,
+                          sinLat * std::cos(az)};
+    ray = Ray{light.position(), dir};
+    return true;
+}
+
+/* Casts light paths from light `i` into `photons` until the workers have
+   saved `budget` photons between them, or cast `maxCasts` paths. Paths are
+   counted in `casted` only if they start before the budget is full, and the
+   photons past it are dropped, so the map and its normalization are the
+   ones a single thread would have built. */
+template<typename PhotonTy>
+void emitterRoutine(const ObjectSet& objects, Index i, Index budget,
+        Index maxCasts, bool save, PhotonHits hits, std::atomic<Index>& mapped,
+        std::atomic<Index>& casted, std::vector<PhotonTy>& photons,
+        Real progressPerPhoton, TextProgressBar& progressBar)
+{
+    Randomizer random {0.0, 1.0};
+    std::vector<PhotonTy> path;
+
+    while (mapped < budget && casted < maxCasts)
+    {
+        Ray ray;
+        Color flux;
+        if (!emitPhoton(objects, i, ray, flux, random))
+            return;
+
+        path.clear();
+        castPhotonToScene<PhotonTy>(objects, ray, flux, path, random, save, hits);
+
+        const Index first = mapped.fetch_add(path.size());
+        if (first >= budget)
+            return;
+
+        const Index kept = numbers::min(Index(path.size()), budget - first);
+        photons.insert(photons.end(), path.begin(), path.begin() + kept);
+        casted++;
+        progressBar.incrementProgress(kept * progressPerPhoton);
+    }
+}
+
+template<typename PhotonTy>
+std::vector<PhotonTy> PhotonMapping::Renderer::
+castPhotons(const ObjectSet& objects, Index totalPhotons, PhotonHits hits,
+        bool nextEventEstimation, bool fromEnvironment,
+        TextProgressBar& progressBar, Real progress)
+{
+    // Most light paths of a scene may not end up as caustics, if any does,
+    // or even hit the scene if they come from the environment
+    constexpr Index maxCastsPerPhoton = 1000;
+
+    const bool environment = objects.environment && fromEnvironment;
+
+    const auto photonsPerLight = dividePhotonsByPower(objects, totalPhotons, environment);
+
+    std::vector<PhotonTy> photonList;
+    photonList.reserve(totalPhotons);
+
+    // Each light is shared by the whole pool, each worker with its own buffer
+    std::vector<std::vector<PhotonTy>> buffers(numThreads());
+    for (Index i : numbers::range(0, photonsPerLight.size()))
+    {
+        const bool isEnvironment = i == objects.pointLights.size();
+        const Index numPhotons = photonsPerLight[i];
+
+        // Direct light of the environment is always read from the map
+        const bool save = !nextEventEstimation || isEnvironment;
+
+        std::atomic<Index> mapped = 0, casted = 0;
+        for (Index w : numbers::range(0, numThreads()))
+        {
+            buffers[w].clear();
+            threadPool[w] = std::thread(emitterRoutine<PhotonTy>, std::cref(objects),
+                    i, numPhotons, maxCastsPerPhoton * numPhotons, save, hits,
+                    std::ref(mapped), std::ref(casted), std::ref(buffers[w]),
+                    progress / totalPhotons, std::ref(progressBar));
+        }
+        for (auto& worker : threadPool)
+            worker.join();
+
+        for (auto& buffer : buffers)
+        {
+            for (auto& p : buffer)
+                p.flux = PackedFlux{Color(p.flux) / Real(casted)};
+            photonList.insert(photonList.end(), buffer.begin(), buffer.end());
+        }
+    }
+
+    return photonList;
+}
+
 template<typename PhotonTy>
 void PhotonMapping::Renderer::
 renderSpecialized(const Camera& cam, Image& img, const ObjectSet& objects,
         Index ppp, Index totalPhotons, Real evalRadius, Index evalNumPhotons,
-        bool nextEventEstimation, bool russianRoulette)
+        bool nextEventEstimation, bool russianRoulette, bool hybrid,
+        bool hashGrid, Index causticPhotons, Real causticRadius,
+        Index causticEvalPhotons, Index gatherRays, Index irradianceSpacing)
 {
     constexpr std::string_view jump_to_previous_line = "\033[F";
 
-    std::cout << "Algorithm: photon mapping\n";
+    const bool finalGathering = gatherRays > 0 && !hybrid;
+
+    std::cout << "Algorithm: photon mapping" << (hybrid ? " (hybrid)" : "")
+              << (finalGathering ? " (final gathering)" : "") << "\n";
     std::cout << "Worker pool size: " << numThreads() << "\n\n";
 
     TextProgressBar progressBar {std::cout}; 
@@ -271,92 +677,283 @@ renderSpecialized(const Camera& cam, Image& img, const ObjectSet& objects,
     std::cout << "Casting photons into the scene...\n";
     progressBar.launch(true /*clear-on-end*/);
 
-    const auto photonsPerLight = dividePhotonsByPower(objects, totalPhotons);
+    // The map of the hybrid mode only has caustics, and its paths find the
+    // ones of the environment. Otherwise they may have a map of their own.
+    // The map of final gathering has every photon, as it is read where
+    // gather rays hit, and the direct light of those hits is in it. Its
+    // caustic map leaves out the environment, which gather rays find after
+    // their specular and refractive bounces.
+    const bool separateCaustics = causticPhotons > 0 && !hybrid;
+    const Real totalCast = totalPhotons + (separateCaustics ? causticPhotons : 0);
+    const PhotonHits hits = hybrid ? PhotonHits::caustics
+                          : separateCaustics && !finalGathering ? PhotonHits::nonCaustics
+                          : PhotonHits::all;
+
+    auto photonList = castPhotons<PhotonTy>(objects, totalPhotons, hits,
+            nextEventEstimation && !finalGathering, !hybrid, progressBar,
+            totalPhotons / totalCast);
+
+    std::vector<PhotonTy> causticList;
+    if (separateCaustics)
+        causticList = castPhotons<PhotonTy>(objects, causticPhotons, PhotonHits::caustics,
+                nextEventEstimation, !finalGathering, progressBar, causticPhotons / totalCast);
 
-    Index photonsInList = 0;
-    std::vector<PhotonTy> photonList(totalPhotons);
+    progressBar.stop();
+    progressBar.join();
+    
+    std::cout << jump_to_previous_line;
+    std::cout << "Casting photons into the scene: done ✔️ \n";
 
-    Randomizer random {0.0, 1.0};
-    for (Index i : numbers::range(0, photonsPerLight.size()))
+    // Builds the maps with `makeMap(photons, radius)` and reads the light of
+    // the scene from them
+    auto gather = [&](auto makeMap)
     {
-        const auto& light = objects.pointLights[i];
-        const Index numPhotons = photonsPerLight[i];
+        std::cout << "Creating photon map...\n";
+        std::cout.flush();
+
+        // Photons where the light of the map is precomputed, spread as the
+        // map is, since the light paths of the list are not in any order
+        std::vector<PhotonTy> irradianceList;
+        if (irradianceSpacing > 0)
+        {
+            irradianceList.reserve(photonList.size() / irradianceSpacing + 1);
+            for (Index i = 0; i < photonList.size(); i += irradianceSpacing)
+                irradianceList.push_back(photonList[i]);
+        }
 
-        Index mapped = 0, casted = 0;
-        std::vector<PhotonTy> lightRegister;
-        PhotonTy photon;
+        auto buildStart = std::chrono::system_clock::now();
+        const auto map = makeMap(std::move(photonList), evalRadius);
+        const std::chrono::duration<double> buildTime = std::chrono::system_clock::now() - buildStart;
 
-        while (mapped < numPhotons)
+        using MapTy = std::decay_t<decltype(map)>;
+        std::optional<MapTy> causticMap;
+        buildStart = std::chrono::system_clock::now();
+        if (separateCaustics)
+            causticMap = makeMap(std::move(causticList), causticRadius);
+        const std::chrono::duration<double> causticBuildTime = std::chrono::system_clock::now() - buildStart;
+
+        std::optional<MapTy> irradianceMap;
+        buildStart = std::chrono::system_clock::now();
+        if (irradianceSpacing > 0)
         {
-            photon.flux = 4 * numbers::pi * light.color();
-
-            const Real cosLat = 2 * random() - 1;
-            photon.lat = std::acos(cosLat);
-            const Real sinLat = std::sin(photon.lat);
-            photon.az = 2 * numbers::pi * random();
-
-            const Direction dir { sinLat * std::sin(photon.az),
-                                  cosLat,
-                                  sinLat * std::cos(photon.az)};
-            
-            Ray ray {light.position(), dir};
-            Real preMapped = mapped;
-            castPhotonToScene<PhotonTy>(objects, ray, photon, lightRegister,
-                    random, numPhotons, mapped, !nextEventEstimation);
-
-            casted++;
-            progressBar.incrementProgress(Real(mapped - preMapped) / totalPhotons);
+            for (Index w : numbers::range(0, numThreads()))
+            {
+                threadPool[w] = std::thread(precomputeRoutine<PhotonTy, MapTy>,
+                        w, numThreads(), std::cref(map), std::ref(irradianceList),
+                        evalRadius, evalNumPhotons);
+            }
+            for (auto& worker : threadPool)
+                worker.join();
+            irradianceMap = makeMap(std::move(irradianceList), evalRadius);
         }
+        const std::chrono::duration<double> irradianceTime = std::chrono::system_clock::now() - buildStart;
+
+        std::cout << jump_to_previous_line;
+        std::cout << "Creating photon map: done ✔️ \n";
+        std::cout << "Photon map: " << map.size() << " photons"
+                  << (hashGrid ? " in a hash grid" : "") << ", built in "
+                  << buildTime.count() << " s\n";
+        if (irradianceMap)
+            std::cout << "Precomputed irradiance: " << irradianceMap->size()
+                      << " photons, in " << irradianceTime.count() << " s\n";
+        if (causticMap)
+            std::cout << "Caustic photon map: " << causticMap->size() << " photons"
+                      << (hashGrid ? " in a hash grid" : "") << ", built in "
+                      << causticBuildTime.count() << " s\n";
+
+        auto caustics = [&](const Point& hit, Index object, const Color& kd)
+        {
+            return causticMap
+                    ? estimateRadiance<PhotonTy>(*causticMap, hit, object, kd,
+                                                 causticRadius, causticEvalPhotons)
+                    : Color{};
+        };
+
+        // Light of the map reflected at diffuse hits, precomputed if it is
+        // and there is an estimate near enough, as there may not be where
+        // photons are sparse
+        auto reflected = [&](const Point& hit, Index object, const Color& kd)
+        {
+            if (irradianceMap)
+                if (const auto precomputed = lookupIrradiance<PhotonTy>(
+                        *irradianceMap, hit, object, kd, evalRadius))
+                    return *precomputed;
+            return estimateRadiance<PhotonTy>(map, hit, object, kd, evalRadius, evalNumPhotons);
+        };
+
+        // Light reflected at diffuse hits, with the caustics of their own map
+        auto estimate = [&](const Point& hit, const Direction&, Index object,
+                const Color& kd, Randomizer&)
+        {
+            return reflected(hit, object, kd) + caustics(hit, object, kd);
+        };
+
+        // Final gathering: the light that reaches diffuse hits from other
+        // surfaces is read from the map where `gatherRays` cosine sampled
+        // rays find a diffuse surface, through specular bounces. Only
+        // caustics, of their own map, are read at the hit itself.
+        auto finalGather = [&](const Point& hit, const Direction& normal,
+                Index object, const Color& kd, Randomizer& random)
+        {
+            auto atGatherHit = [&](const Point& gatherHit, const Direction&,
+                    Index gatherObject, const Color& gatherKd, Randomizer&)
+            {
+                return reflected(gatherHit, gatherObject, gatherKd);
+            };
 
-        for (auto& p : lightRegister)
-            p.flux = p.flux / casted;
+            Color incoming;
+            for ([[maybe_unused]] Index r : numbers::range(0, gatherRays))
+            {
+                const Direction d = uniformCosineSampling(normal, random);
+                incoming = incoming + castRayToScene(objects, Ray{hit + d * 0.0001, d},
+                        atGatherHit, random, false, russianRoulette);
+            }
+
+            return kd * incoming / gatherRays + caustics(hit, object, kd);
+        };
+
+        std::cout << "Reading light from the scene...\n";
+        std::cout.flush();
+        progressBar.launch(true);
         
-        std::copy(lightRegister.begin(), lightRegister.end(),
-                photonList.begin() + photonsInList);
+        const Real totalSize = taskDivider.width * taskDivider.height;
+        const Real regionSize = taskDivider.regionWidth * taskDivider.regionHeight;
+        const Real increment = regionSize / totalSize;
+
+        auto launch = [&](const auto& estimator)
+        {
+            using Estimate = std::decay_t<decltype(estimator)>;
+            leader = std::thread(leaderRoutine, 
+                    std::ref(tasks), std::ref(taskDivider));
+            for (auto& worker : threadPool)
+            {
+                worker = std::thread(workerRoutine<Estimate>, std::ref(tasks), increment,
+                        std::cref(cam), std::ref(img), std::cref(objects), ppp,
+                        std::cref(estimator), std::ref(progressBar),
+                        nextEventEstimation, russianRoulette, hybrid);
+            }
+
+            leader.join();
+            for (auto& worker : threadPool)
+                worker.join();
+        };
+
+        if (finalGathering)
+            launch(finalGather);
+        else
+            launch(estimate);
+
+        progressBar.stop();
+        progressBar.join();
         
-        photonsInList += mapped;
-    }
+        std::cout << jump_to_previous_line;
+        std::cout << "Reading light from the scene: done ✔️ \n";
+    };
 
-    progressBar.stop();
-    progressBar.join();
-    
-    std::cout << jump_to_previous_line;
-    std::cout << "Casting photons into the scene: done ✔️ \n";
+    if (hashGrid)
+        gather([&](std::vector<PhotonTy>&& photons, Real radius)
+        {
+            return PhotonGrid<PhotonTy>{std::move(photons), radius};
+        });
+    else
+        gather([&](std::vector<PhotonTy>&& photons, Real)
+        {
+            return PhotonMap<PhotonTy>{std::move(photons), {}, numThreads()};
+        });
 
-    std::cout << "Creating photon map...\n";
-    PhotonMap<PhotonTy> map {photonList, {}};
-    std::vector<PhotonTy>().swap(photonList);
+    img.updateLuminance();
 
-    std::cout << jump_to_previous_line;
-    std::cout << "Creating photon map: done ✔️ \n";
+    std::cout << std::endl;
+}
 
-    std::cout << "Reading light from the scene...\n";
-    std::cout.flush();
-    progressBar.launch(true);
-    
-    const Real totalSize = taskDivider.width * taskDivider.height;
-    const Real regionSize = taskDivider.regionWidth * taskDivider.regionHeight;
-    const Real increment = regionSize / totalSize;
+template<typename PhotonTy>
+void PhotonMapping::Renderer::
+renderProgressiveSpecialized(const Camera& cam, Image& img,
+        const ObjectSet& objects, Index photonsPerIteration, Real initialRadius,
+        bool nextEventEstimation, bool hashGrid, Index iterations, Real seconds)
+{
+    constexpr std::string_view jump_to_previous_line = "\033[F";
 
-    leader = std::thread(leaderRoutine, 
-            std::ref(tasks), std::ref(taskDivider));
-    for (auto& worker : threadPool)
+    std::cout << "Algorithm: progressive photon mapping\n";
+    std::cout << "Worker pool size: " << numThreads() << "\n\n";
+
+    const Index width = taskDivider.width, height = taskDivider.height;
+    std::vector<PixelStatistics> pixels(width * height,
+            PixelStatistics{initialRadius * initialRadius, 0, {}, {}});
+
+    TextProgressBar progressBar {std::cout};
+
+    std::cout << "Casting and reading photons...\n";
+    progressBar.launch(true /*clear-on-end*/);
+
+    // Reads the photons of an iteration from `map`
+    auto gather = [&](const auto& map)
     {
-        worker = std::thread(workerRoutine<PhotonTy>, std::ref(tasks), increment,
-                std::cref(cam), std::ref(img), std::cref(objects), ppp,
-                evalRadius, evalNumPhotons, std::cref(map),
-                std::ref(progressBar), nextEventEstimation, russianRoulette);
-    }
+        using MapTy = std::decay_t<decltype(map)>;
+        for (Index w : numbers::range(0, numThreads()))
+        {
+            threadPool[w] = std::thread(progressiveWorkerRoutine<PhotonTy, MapTy>,
+                    w, numThreads(), std::cref(cam), std::cref(objects),
+                    std::cref(map), std::ref(pixels), width, height,
+                    nextEventEstimation);
+        }
+        for (auto& worker : threadPool)
+            worker.join();
+    };
+
+    const auto start = std::chrono::system_clock::now();
+    Index iteration = 0;
+    Real progress = 0;
+    bool finished = false;
+    while (!finished)
+    {
+        auto photons = castPhotons<PhotonTy>(objects, photonsPerIteration,
+                PhotonHits::all, nextEventEstimation, true, progressBar, 0);
 
-    leader.join();
-    for (auto& worker : threadPool)
-        worker.join();
+        if (hashGrid)
+        {
+            // Cells for the largest radius left
+            Real radius2 = 0;
+            for (const auto& pixel : pixels)
+                radius2 = numbers::max(radius2, pixel.radius2);
+            gather(PhotonGrid<PhotonTy>{std::move(photons), std::sqrt(radius2)});
+        }
+        else
+            gather(PhotonMap<PhotonTy>{std::move(photons), {}, numThreads()});
+
+        iteration++;
+        const std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+
+        // Progress of the budget that runs out first
+        Real done = 0;
+        if (iterations > 0)
+            done = numbers::max(done, Real(iteration) / iterations);
+        if (seconds > 0)
+            done = numbers::max(done, Real(elapsed.count() / seconds));
+        done = numbers::min(done, Real(1));
+        progressBar.incrementProgress(done - progress);
+        progress = done;
+        finished = done >= 1;
+    }
 
     progressBar.stop();
     progressBar.join();
-    
+
     std::cout << jump_to_previous_line;
-    std::cout << "Reading light from the scene: done ✔️ \n";
+    std::cout << "Casting and reading photons: done ✔️ \n";
+
+    Real meanRadius = 0;
+    for (Index i : numbers::range(0, height))
+    for (Index j : numbers::range(0, width))
+    {
+        const PixelStatistics& pixel = pixels[i * width + j];
+        img(i, j) = RGBPixel((pixel.direct
+                              + pixel.flux / (numbers::pi * pixel.radius2))
+                             / iteration);
+        meanRadius += std::sqrt(pixel.radius2) / pixels.size();
+    }
+    std::cout << "Progressive photon mapping: " << iteration << " iterations of "
+              << photonsPerIteration << " photons, mean radius " << meanRadius << "\n";
 
     img.updateLuminance();
 
@@ -367,18 +964,44 @@ void PhotonMapping::Renderer::
 render(const Camera& cam, Image& img, const ObjectSet& objects,
         Index ppp, Index totalPhotons, Real evalRadius,
         Index evalNumPhotons, bool nextEventEstimation,
-        bool onlyCountSameShapePhotons, bool russianRoulette)
+        bool onlyCountSameShapePhotons, bool russianRoulette, bool hybrid,
+        bool hashGrid, Index causticPhotons, Real causticRadius,
+        Index causticEvalPhotons, Index gatherRays, Index irradianceSpacing)
 {
     if (onlyCountSameShapePhotons)
     {
         renderSpecialized<SPhoton>(cam, img, objects,
                 ppp, totalPhotons, evalRadius, evalNumPhotons,
-                nextEventEstimation, russianRoulette);
+                nextEventEstimation, russianRoulette, hybrid, hashGrid,
+                causticPhotons, causticRadius, causticEvalPhotons, gatherRays,
+                irradianceSpacing);
     }
     else
     {
         renderSpecialized<Photon>(cam, img, objects,
                 ppp, totalPhotons, evalRadius, evalNumPhotons,
-                nextEventEstimation, russianRoulette);
+                nextEventEstimation, russianRoulette, hybrid, hashGrid,
+                causticPhotons, causticRadius, causticEvalPhotons, gatherRays,
+                irradianceSpacing);
+    }
+}
+
+void PhotonMapping::Renderer::
+renderProgressive(const Camera& cam, Image& img, const ObjectSet& objects,
+        Index photonsPerIteration, Real initialRadius, bool nextEventEstimation,
+        bool onlyCountSameShapePhotons, bool hashGrid, Index iterations,
+        Real seconds)
+{
+    if (onlyCountSameShapePhotons)
+    {
+        renderProgressiveSpecialized<SPhoton>(cam, img, objects,
+                photonsPerIteration, initialRadius, nextEventEstimation,
+                hashGrid, iterations, seconds);
+    }
+    else
+    {
+        renderProgressiveSpecialized<Photon>(cam, img, objects,
+                photonsPerIteration, initialRadius, nextEventEstimation,
+                hashGrid, iterations, seconds);
     }
 }
@@ -2,8 +2,11 @@
 #include "shapes.hpp"
 #include "geometry.hpp"
 #include "object_set.hpp"
+#include "path_guiding.hpp"
 
+#include <atomic>
 #include <iostream>
+#include <vector>
 
 Camera::Camera(Point pinhole, Direction front, Direction up, Dimensions dim)
     : f { front },
@@ -34,39 +37,274 @@ Ray Camera::randomRay(Index i, Index j)
     return {o, normalize((x * l) + (y * u) + f)};
 }
 
-Color castShadowRays(const ObjectSet& objSet, const Direction& normal,
-        const Point& hit, const Color& kd)
+Real Camera::directionPdf(const Direction& d) const
 {
-    Color color {0, 0, 0};
-    for (const PointLight& light : objSet.pointLights)
+    const Real depth = dot(d, f) / dot(f, f);
+    if (depth <= 0)
+        return 0;
+
+    // Image plane coordinates, both in [-1, 1]
+    const Real x = dot(d, l) / dot(l, l) / depth;
+    const Real y = dot(d, u) / dot(u, u) / depth;
+    if (std::abs(x) > 1 || std::abs(y) > 1)
+        return 0;
+
+    // Uniform over the image plane, whose area is 2|l| * 2|u| at distance |f|
+    const Real distance = norm(f);
+    const Real cosine = depth * distance;
+    const Real area = 4 * norm(l) * norm(u);
+    return (distance * distance) / (area * cosine * cosine * cosine);
+}
+
+Camera::Projection Camera::project(const Point& p) const
+{
+    const Direction d = p - o;
+    const Real depth = dot(d, f) / dot(f, f);
+    if (depth <= 0)
+        return {false, 0, 0};
+
+    const Real x = dot(d, l) / dot(l, l) / depth;
+    const Real y = dot(d, u) / dot(u, u) / depth;
+    if (std::abs(x) >= 1 || std::abs(y) >= 1)
+        return {false, 0, 0};
+
+    return {true, static_cast<Index>((1 - y) / pixelHeight),
+                  static_cast<Index>((1 - x) / pixelWidth)};
+}
+
+namespace {
+
+std::atomic<Index> shadowCacheTests {0};
+std::atomic<Index> shadowCacheHits {0};
+
+/* Last object that blocked the shadow rays of each point light, for the
+   calling thread. Shadow rays of neighbouring hits tend to be blocked by
+   the same object, so it is tested before the rest of the scene. The
+   counters are only added to the global ones when the thread finishes. */
+struct ShadowOccluderCache
+{
+    const ObjectSet* objSet = nullptr;
+    std::vector<const Object*> lastOccluder;
+    Index tests = 0, hits = 0;
+
+    ~ShadowOccluderCache()
+    {
+        shadowCacheTests += tests;
+        shadowCacheHits += hits;
+    }
+
+    const Object*& occluder(const ObjectSet& set, Index light)
     {
-        const Direction d = light.position() - hit;
-        const Real d2 = dot(d, d);
-        const Real distance = std::sqrt(d2);
-        const Direction dN = d / distance; // normalized d
-        
-        const Direction epsilon = dN * 0.0001;
-
-        const Ray shadowRay {hit + epsilon, dN};
-        auto isThereNearerObject = [&](Real distance) -> bool
+        if (objSet != &set)
         {
-            for (const Object& obj : objSet.objects)
-            {
-                const auto its = obj.shape().intersect(shadowRay);
-                if (Ray::isHit(its) && its < distance)
-                    return true;
-            }
-            return false;
-        };
-
-        if (isThereNearerObject(distance))
+            objSet = &set;
+            lastOccluder.assign(set.pointLights.size(), nullptr);
+        }
+        return lastOccluder[light];
+    }
+};
+
+thread_local ShadowOccluderCache shadowOccluderCache;
+
+// Returns the first object found between the origin of the ray and
+// `distance`, or nullptr. `cached` is tested first.
+const Object* findOccluder(const ObjectSet& objSet, const Ray& shadowRay,
+        Real distance, const Object* cached = nullptr)
+{
+    if (cached)
+    {
+        const auto its = cached->shape().intersect(shadowRay);
+        if (Ray::isHit(its) && its < distance)
+            return cached;
+    }
+
+    for (const Object& obj : objSet.objects)
+    {
+        if (&obj == cached)
             continue;
+        const auto its = obj.shape().intersect(shadowRay);
+        if (Ray::isHit(its) && its < distance)
+            return &obj;
+    }
+    return nullptr;
+}
+
+// Whether the shadow ray of light `index` is blocked, testing first the
+// last object that blocked that light in this thread
+bool occludedCached(const ObjectSet& objSet, Index index,
+        const Ray& shadowRay, Real distance)
+{
+    auto& cache = shadowOccluderCache;
+    const Object*& cached = cache.occluder(objSet, index);
+    const Object* occluder = findOccluder(objSet, shadowRay, distance, cached);
+    if (cached)
+    {
+        cache.tests++;
+        if (occluder == cached)
+            cache.hits++;
+    }
+    if (occluder)
+        cached = occluder;
+    return occluder;
+}
+
+// castShadowRay for light `index`, looked up in its shadow map if the set
+// has them, or else with the occluder cache
+Color castCachedShadowRay(const ObjectSet& objSet, Index index,
+        const Direction& normal, const Point& hit, const Color& kd)
+{
+    const PointLight& light = objSet.pointLights[index];
+    const Direction d = light.position() - hit;
+    const Real d2 = dot(d, d);
+    const Real distance = std::sqrt(d2);
+    const Direction dN = d / distance; // normalized d
+
+    const ShadowMaps& maps = objSet.shadowMaps;
+    const bool occluded = maps.empty()
+            ? occludedCached(objSet, index, {hit + dN * 0.0001, dN}, distance)
+            : !maps.visible(index, hit, dot(normal, dN));
+    if (occluded)
+        return {};
+
+    const Color emission = light.color() / d2;
+    const Real term = std::abs(dot(normal, dN));
+    return (emission * kd / numbers::pi) * term;
+}
+
+} //namespace
+
+Color castShadowRay(const ObjectSet& objSet, const PointLight& light,
+        const Direction& normal, const Point& hit, const Color& kd)
+{
+    const Direction d = light.position() - hit;
+    const Real d2 = dot(d, d);
+    const Real distance = std::sqrt(d2);
+    const Direction dN = d / distance; // normalized d
+    
+    const Direction epsilon = dN * 0.0001;
 
-        const Color emission = light.color() / d2;
-        const Real term = std::abs(dot(normal, dN));
-        color = color + (emission * kd / numbers::pi) * term;
+    const Ray shadowRay {hit + epsilon, dN};
+    if (findOccluder(objSet, shadowRay, distance))
+        return {};
+
+    const Color emission = light.color() / d2;
+    const Real term = std::abs(dot(normal, dN));
+    return (emission * kd / numbers::pi) * term;
+}
+
+Color castShadowRays(const ObjectSet& objSet, const Direction& normal,
+        const Point& hit, const Color& kd, Randomizer& random)
+{
+    Color color {0, 0, 0};
+    const LightTree& tree = objSet.lightTree;
+    if (tree.empty())
+    {
+        for (Index light : numbers::range(0, objSet.pointLights.size()))
+            color = color + castCachedShadowRay(objSet, light, normal, hit, kd);
+        return color;
+    }
+
+    const Index samples = tree.samplesPerPoint();
+    for ([[maybe_unused]] Index s : numbers::range(0, samples))
+    {
+        const auto [light, pdf] = tree.sample(hit, normal, random);
+        if (pdf > 0)
+            color = color + castCachedShadowRay(objSet, light, normal, hit, kd) / pdf;
+    }
+    return color / samples;
+}
+
+ShadowCacheStats shadowCacheStats()
+{
+    return {shadowCacheTests, shadowCacheHits};
+}
+
+Color castAreaShadowRay(const ObjectSet& objSet, const Direction& normal,
+        const Point& hit, const Color& kd, Randomizer& random,
+        const DirectionalTree* guide, bool unweighted)
+{
+    const Index numLights = objSet.areaLights.size();
+    if (numLights == 0)
+        return {};
+
+    const Index chosen = numbers::min(Index(random() * numLights), numLights - 1);
+    const AreaLight& light = objSet.areaLights[chosen];
+    const auto [point, lightNormal] = light.shape().sample(random);
+
+    const Direction d = point - hit;
+    const Real d2 = dot(d, d);
+    const Real distance = std::sqrt(d2);
+    const Direction dN = d / distance; // normalized d
+
+    const Real cosHit = dot(normal, dN);
+    const Real cosLight = std::abs(dot(lightNormal, dN));
+    if (cosHit <= 0 || cosLight <= 0)
+        return {};
+
+    const Ray shadowRay {hit + dN * 0.0001, dN};
+    for (const Object& obj : objSet.objects)
+    {
+        // The light itself is found at `distance`
+        const auto its = obj.shape().intersect(shadowRay);
+        if (Ray::isHit(its) && its < distance * 0.999)
+            return {};
     }
-    return color;
+
+    const Real lightPdf = d2 / (cosLight * light.shape().area()) / numLights;
+    const Real cosinePdf = cosHit / numbers::pi;
+    const Real bsdfPdf = guide ? guide->mixturePdf(dN, normal, cosinePdf) : cosinePdf;
+    const Real weight = unweighted ? 1 : powerHeuristic(lightPdf, bsdfPdf);
+
+    return (light.color() * kd / numbers::pi) * (cosHit * weight / lightPdf);
+}
+
+Color castEnvironmentShadowRay(const ObjectSet& objSet, const Direction& normal,
+        const Point& hit, const Color& kd, Randomizer& random,
+        const DirectionalTree* guide)
+{
+    if (!objSet.environment)
+        return {};
+
+    const auto [d, radiance, lightPdf] = objSet.environment->sample(random);
+    const Real cosHit = dot(normal, d);
+    if (cosHit <= 0 || lightPdf <= 0)
+        return {};
+
+    // Nothing in between
+    const Ray shadowRay {hit + d * 0.0001, d};
+    for (const Object& obj : objSet.objects)
+        if (Ray::isHit(obj.shape().intersect(shadowRay)))
+            return {};
+
+    const Real cosinePdf = cosHit / numbers::pi;
+    const Real bsdfPdf = guide ? guide->mixturePdf(d, normal, cosinePdf) : cosinePdf;
+    const Real weight = powerHeuristic(lightPdf, bsdfPdf);
+
+    return (radiance * kd / numbers::pi) * (cosHit * weight / lightPdf);
+}
+
+Color environmentRadiance(const ObjectSet& objSet, const Ray& ray, Real bsdfPdf)
+{
+    if (!objSet.environment)
+        return {};
+
+    const Color radiance = objSet.environment->radiance(ray.d);
+    if (bsdfPdf <= 0)
+        return radiance;
+    return radiance * powerHeuristic(bsdfPdf, objSet.environment->pdf(ray.d));
+}
+
+Real areaLightPdf(const ObjectSet& objSet, const Shape& shape, const Ray& ray, Real t)
+{
+    if (!shape.isBounded())
+        return 0;
+
+    const Point hit = ray.hitPoint(t);
+    const Real cosLight = std::abs(dot(shape.normal(ray.d, hit).normal, ray.d));
+    if (cosLight <= 0)
+        return 0;
+
+    return (t * t) / (cosLight * shape.area()) / objSet.areaLights.size();
 }
 
 Intersection findIntersection(const ObjectSet& objSet, const Ray& ray)
@@ -7,12 +7,15 @@
 #include "image.hpp"
 #include "image_writer.hpp"
 #include "path_tracing.hpp"
+#include "bidirectional_path_tracing.hpp"
+#include "instant_radiosity.hpp"
 #include "photon_mapping.hpp"
 #include "scene_reader.hpp"
 
 #include "program.hpp"
 
-enum class Algorithm {photon_mapping, path_tracing};
+enum class Algorithm {photon_mapping, path_tracing, bidirectional_path_tracing,
+                      instant_radiosity};
 
 static constexpr std::string_view helpStr = R"(
 Usage: ./renderer [OPTION...] SCENE_FILE OUTPUT_FILE
@@ -42,12 +45,28 @@ Ray tracing common parameters:
 
   -a, --algorithm=STRING           Set the ray tracing algorithm.
 
-      Available algorithms: path-tracing (pt), photon-mapping (pm)
+      Available algorithms: path-tracing (pt), photon-mapping (pm),
+                            bidirectional-path-tracing (bdpt),
+                            instant-radiosity (vpl)
 
   -p, --paths-per-pixel=INT        Set the number of samples per pixel.
                                    Default value for path tracing is 100,
-                                   whereas for photon mapping the default
-                                   value is 10.
+                                   whereas for photon mapping and instant
+                                   radiosity the default value is 10.
+
+  -L, --light-sampling=STRING      Set how point lights are sampled at
+                                   every shading point.
+
+      Available strategies:
+        all         ->  Casts a shadow ray to every light (default)
+        tree[:INT]  ->  Picks INT lights (1 by default) from a light
+                        hierarchy, proportionally to their estimated
+                        contribution
+
+  -M, --shadow-maps=INT            Approximate point light shadows with
+                                   cube depth maps of INTxINT texels per
+                                   face, built before rendering, instead
+                                   of shadow rays. Disabled (0) by default.
 
 
 Path tracing special parameters:
@@ -61,9 +80,46 @@ Path tracing special parameters:
       Available implementations:
         trace-projection    ->  Considers every object is an area light
         trace-direct-light  ->  Only traces direct light
+        resample-direct-light
+                            ->  Only traces direct light, resampling
+                                point lights with reservoirs shared
+                                between neighbouring pixels of a task
         recursive           ->  Traces indirect light recursively
         iterative           ->  Traces indirect light iteratively
 
+  -S, --split-factor=INT           Set the number of secondary paths traced
+                                   from the first diffuse hit of every
+                                   sample. Indirect strategies only.
+                                   Default value is 1 (no splitting).
+
+  -I, --irradiance-cache-error=REAL
+                                   Use an irradiance cache for indirect
+                                   light at the first diffuse hit, with
+                                   this maximum error between records
+                                   (0.1 - 0.3 are reasonable values).
+                                   Indirect strategies only. Disabled (0)
+                                   by default.
+
+  -G, --path-guiding-passes=INT    Learn the incident light of the scene
+                                   during INT training passes (with 1, 2,
+                                   4... samples per pixel) and use it to
+                                   guide diffuse bounces. Indirect
+                                   strategies only. Disabled (0) by default.
+
+  -n, --noise-threshold=REAL       Sample pixels adaptively, in rounds,
+                                   until the relative standard error of
+                                   their mean falls below REAL (e.g. 0.01)
+                                   or they take the paths per pixel.
+                                   Black pixels take every path.
+                                   Disabled (0) by default.
+
+  -F, --indirect-downsampling=INT  Trace diffuse indirect light at the
+                                   first hit at 1/INT of the resolution
+                                   (2 or 4), and upsample it guided by the
+                                   normals and depths of the hits. Indirect
+                                   strategies only, without adaptive
+                                   sampling. Disabled (1) by default.
+
 
 Photon mapping special parameters:
 
@@ -73,6 +129,67 @@ Photon mapping special parameters:
 
   -R[=BOOL], --photon-mapping-use-russian-roulette[=BOOL] 
 
+  -H[=BOOL], --photon-mapping-hybrid[=BOOL]
+                                   Path trace direct and diffuse indirect
+                                   light, and only keep caustic photons
+                                   (arrived through specular or refractive
+                                   bounces) in the map.
+
+  -U[=BOOL], --photon-mapping-hash-grid[=BOOL]
+                                   Look photons up in a hashed uniform grid
+                                   with cells twice as wide as the
+                                   evaluation radius instead of a kd-tree.
+
+  -K, --photon-mapping-caustic-photons=INT
+                                   Keep caustic photons (arrived through
+                                   specular or refractive bounces only) in
+                                   a map of their own of INT photons, and
+                                   the rest in the map of the total saved
+                                   photons. Not hybrid nor progressive.
+                                   Disabled (0) by default.
+
+  -k, --photon-mapping-caustic-radius=REAL
+                                   Set the evaluation radius of the caustic
+                                   map. Default value is 0.1.
+
+  -J, --photon-mapping-caustic-evaluation-photons=INT
+                                   Set the number of neighbor photons
+                                   evaluated from the caustic map. Default
+                                   value is 10000.
+
+  -g, --photon-mapping-final-gathering=INT
+                                   Read the light that diffuse hits get
+                                   from other surfaces where INT rays from
+                                   them hit, and only caustics at the hits.
+                                   Needs next event estimation (-N) and a
+                                   caustic map (-K), since gather rays
+                                   cannot find point lights. Not hybrid,
+                                   progressive nor with russian roulette
+                                   (-R). Disabled (0) by default.
+
+  -i, --photon-mapping-precomputed-irradiance=INT
+                                   Estimate the light of the map at one
+                                   photon of every INT once it is built,
+                                   and read the nearest estimate instead of
+                                   the photons around diffuse hits. Faster,
+                                   but blotchier unless final gathering
+                                   (-g) hides it. Not hybrid nor
+                                   progressive. Disabled (0) by default.
+
+  -P, --photon-mapping-progressive-iterations=INT
+                                   Render progressively in INT iterations,
+                                   each casting the total saved photons,
+                                   reading them with a new path per pixel
+                                   and discarding them. Pixels start at
+                                   the evaluation radius and shrink it as
+                                   they read photons. Not hybrid. Disabled
+                                   (0) by default.
+
+  -T, --photon-mapping-progressive-time=REAL
+                                   Render progressively, as with -P, until
+                                   REAL seconds have passed. Disabled (0)
+                                   by default.
+
   -r, --photon-mapping-evaluation-radius=REAL   Set the radius of the
                                                 spherical limit where
                                                 neighbor photons are
@@ -85,6 +202,18 @@ Photon mapping special parameters:
                                                 photons collisions within
                                                 the scene.
 
+
+Instant radiosity special parameters:
+
+  -V, --virtual-point-lights=INT   Set the number of virtual point lights
+                                   left by light paths. Default value is
+                                   1000.
+
+  -m, --virtual-point-lights-min-distance=REAL
+                                   Clamp the light of virtual point lights
+                                   as if they were at least this far from
+                                   the shaded point. Default value is 0.2.
+
 Parallelization parameters:
 
   -D, --task-division=STRING       Array of pixels that compounds a task.
@@ -120,19 +249,39 @@ struct RawArguments
     Arg task_queue_size;  // -Q INT
     
     // Render algorithm
-    Arg algorithm; // -a path-tracing | pt | photon-mapping | pm
+    Arg algorithm; // -a path-tracing | pt | photon-mapping | pm | bidirectional-path-tracing | bdpt | instant-radiosity | vpl
 
     // Path tracing parameters
     Arg paths_per_pixel;       // -p INT
-    Arg path_tracing_strategy; // -s trace-projection | trace-direct-light | recursive | iterative
+    Arg light_sampling;        // -L all | tree[:INT]
+    Arg shadow_maps;           // -M INT
+    Arg split_factor;          // -S INT
+    Arg irradiance_cache_error; // -I REAL
+    Arg noise_threshold;       // -n REAL
+    Arg indirect_downsampling; // -F INT
+    Arg path_guiding_passes;    // -G INT
+    Arg path_tracing_strategy; // -s trace-projection | trace-direct-light | resample-direct-light | recursive | iterative
     
     // Photon mapping parameters
     Arg photon_mapping_use_next_event_estimation; // -N [BOOL]
     Arg photon_mapping_exclusive_evaluation;      // -E [BOOL]
     Arg photon_mapping_use_russian_roulette;      // -R [BOOL]
+    Arg photon_mapping_hybrid;                    // -H [BOOL]
+    Arg photon_mapping_hash_grid;                 // -U [BOOL]
+    Arg photon_mapping_caustic_photons;           // -K INT
+    Arg photon_mapping_caustic_radius;            // -k REAL
+    Arg photon_mapping_caustic_evaluation_photons; // -J INT
+    Arg photon_mapping_final_gathering;           // -g INT
+    Arg photon_mapping_precomputed_irradiance;    // -i INT
+    Arg photon_mapping_progressive_iterations;    // -P INT
+    Arg photon_mapping_progressive_time;          // -T REAL
     Arg photon_mapping_evaluation_radius;         // -r REAL
     Arg photon_mapping_evaluation_photons;        // -e INT
     Arg photon_mapping_total_saved_photons;       // -t INT
+
+    // Instant radiosity parameters
+    Arg virtual_point_lights;              // -V INT
+    Arg virtual_point_lights_min_distance; // -m REAL
 };
 
 struct Arguments
@@ -154,15 +303,35 @@ struct Arguments
 
     // Path tracing parameters
     Natural paths_per_pixel = 100; // Depends on algorithm: pt -> 100 / pm -> 10
+    Index light_tree_samples = 0; // 0 -> all lights
+    Index shadow_map_resolution = 0; // 0 -> shadow rays
     PathTracing::Strategy path_tracing_strategy = PathTracing::Strategy::recursive;
+    Index split_factor = 1;
+    Real irradiance_cache_error = 0; // disabled
+    Index path_guiding_passes = 0;   // disabled
+    Real noise_threshold = 0;        // disabled
+    Index indirect_downsampling = 1; // disabled
     
     // Photon mapping parameters
     bool photon_mapping_use_next_event_estimation = false;
     bool photon_mapping_exclusive_evaluation = false;
     bool photon_mapping_use_russian_roulette = false;
+    bool photon_mapping_hybrid = false;
+    bool photon_mapping_hash_grid = false;
+    Index photon_mapping_caustic_photons = 0; // disabled
+    Real photon_mapping_caustic_radius = 0.1;
+    Index photon_mapping_caustic_evaluation_photons = 10'000;
+    Index photon_mapping_final_gathering = 0; // disabled
+    Index photon_mapping_precomputed_irradiance = 0; // disabled
+    Index photon_mapping_progressive_iterations = 0; // disabled
+    Real photon_mapping_progressive_time = 0;        // disabled
     Real photon_mapping_evaluation_radius = 0.4;
     Index photon_mapping_evaluation_photons = 10'000; // all
     Index photon_mapping_total_saved_photons = 10'000;
+
+    // Instant radiosity parameters
+    Index virtual_point_lights = 1000;
+    Real virtual_point_lights_min_distance = 0.2;
 };
 
 Arguments processArgs(const RawArguments& raw)
@@ -254,6 +423,10 @@ Arguments processArgs(const RawArguments& raw)
             args.algorithm = Algorithm::path_tracing;
         else if (oneOf(raw.algorithm, {"photon-mapping", "pm"}))
             args.algorithm = Algorithm::photon_mapping;
+        else if (oneOf(raw.algorithm, {"bidirectional-path-tracing", "bdpt"}))
+            args.algorithm = Algorithm::bidirectional_path_tracing;
+        else if (oneOf(raw.algorithm, {"instant-radiosity", "vpl"}))
+            args.algorithm = Algorithm::instant_radiosity;
         else
             program::exit(program::err(), "Not supported algorithm.");
     }
@@ -262,14 +435,34 @@ Arguments processArgs(const RawArguments& raw)
         if (!readNumber(raw.paths_per_pixel, args.paths_per_pixel))
             program::exit(program::err(), "Invalid paths per pixel value.");
     } 
-    else if (args.algorithm == Algorithm::photon_mapping)
-        args.paths_per_pixel = 10; // Default value for photon mapping
+    else if (args.algorithm == Algorithm::photon_mapping
+            || args.algorithm == Algorithm::instant_radiosity)
+        args.paths_per_pixel = 10; // Default value for photon mapping and instant radiosity
+
+    if (set(raw.light_sampling)) {
+        if (oneOf(raw.light_sampling, {"all"}))
+            args.light_tree_samples = 0;
+        else if (oneOf(raw.light_sampling, {"tree"}))
+            args.light_tree_samples = 1;
+        else if (raw.light_sampling.substr(0, 5) != "tree:"
+                 || !readNumber(raw.light_sampling.substr(5), args.light_tree_samples)
+                 || args.light_tree_samples == 0)
+            program::exit(program::err(), "Invalid light sampling strategy.");
+    }
+
+    if (set(raw.shadow_maps)
+        && !readNumber(raw.shadow_maps, args.shadow_map_resolution))
+    {
+        program::exit(program::err(), "Invalid shadow map resolution.");
+    }
 
     if (set(raw.path_tracing_strategy)) {
         if (raw.path_tracing_strategy == "trace-projection")
             args.path_tracing_strategy = PathTracing::Strategy::trace_projection;
         else if (raw.path_tracing_strategy == "trace-direct-light")
             args.path_tracing_strategy = PathTracing::Strategy::trace_direct_light;
+        else if (raw.path_tracing_strategy == "resample-direct-light")
+            args.path_tracing_strategy = PathTracing::Strategy::resample_direct_light;
         else if (raw.path_tracing_strategy == "recursive")
             args.path_tracing_strategy = PathTracing::Strategy::recursive;
         else if (raw.path_tracing_strategy == "iterative")
@@ -278,6 +471,48 @@ Arguments processArgs(const RawArguments& raw)
             program::exit(program::err(), "Not supported path tracing strategy.");
     }
 
+    if (set(raw.split_factor)
+        && (!readNumber(raw.split_factor, args.split_factor) || args.split_factor == 0))
+    {
+        program::exit(program::err(), "Invalid split factor.");
+    }
+
+    if (set(raw.irradiance_cache_error)
+        && (!readNumber(raw.irradiance_cache_error, args.irradiance_cache_error)
+            || args.irradiance_cache_error < 0))
+    {
+        program::exit(program::err(), "Invalid irradiance cache error.");
+    }
+
+    if (set(raw.path_guiding_passes)
+        && !readNumber(raw.path_guiding_passes, args.path_guiding_passes))
+    {
+        program::exit(program::err(), "Invalid number of path guiding passes.");
+    }
+
+    if (set(raw.noise_threshold)
+        && (!readNumber(raw.noise_threshold, args.noise_threshold)
+            || args.noise_threshold < 0))
+    {
+        program::exit(program::err(), "Invalid noise threshold.");
+    }
+
+    if (set(raw.indirect_downsampling)
+        && (!readNumber(raw.indirect_downsampling, args.indirect_downsampling)
+            || args.indirect_downsampling == 0))
+    {
+        program::exit(program::err(), "Invalid indirect light downsampling factor.");
+    }
+
+    if (args.indirect_downsampling > 1
+        && ((args.path_tracing_strategy != PathTracing::Strategy::recursive
+             && args.path_tracing_strategy != PathTracing::Strategy::iterative)
+            || args.noise_threshold > 0))
+    {
+        program::exit(program::err(), "Indirect light downsampling needs an indirect "
+                                      "strategy and no noise threshold.");
+    }
+
     auto getBool = [set, oneOf](std::string_view str, bool& opt)
     {
         if (set(str)) {
@@ -299,6 +534,97 @@ Arguments processArgs(const RawArguments& raw)
     getBool(raw.photon_mapping_use_russian_roulette,
             args.photon_mapping_use_russian_roulette);
 
+    getBool(raw.photon_mapping_hybrid, args.photon_mapping_hybrid);
+
+    getBool(raw.photon_mapping_hash_grid, args.photon_mapping_hash_grid);
+
+    if (set(raw.photon_mapping_caustic_photons)
+        && !readNumber(raw.photon_mapping_caustic_photons,
+                       args.photon_mapping_caustic_photons))
+    {
+        program::exit(program::err(), "Invalid number of caustic photons.");
+    }
+
+    if (set(raw.photon_mapping_caustic_radius)
+        && (!readNumber(raw.photon_mapping_caustic_radius,
+                        args.photon_mapping_caustic_radius)
+            || args.photon_mapping_caustic_radius <= 0.0) )
+    {
+        program::exit(program::err(), "Invalid caustic evaluation radius.");
+    }
+
+    if (set(raw.photon_mapping_caustic_evaluation_photons)
+        && !readNumber(raw.photon_mapping_caustic_evaluation_photons,
+                       args.photon_mapping_caustic_evaluation_photons))
+    {
+        program::exit(program::err(), "Invalid number of caustic evaluation photons.");
+    }
+
+    if (set(raw.photon_mapping_final_gathering)
+        && !readNumber(raw.photon_mapping_final_gathering,
+                       args.photon_mapping_final_gathering))
+    {
+        program::exit(program::err(), "Invalid number of final gathering rays.");
+    }
+
+    if (set(raw.photon_mapping_precomputed_irradiance)
+        && !readNumber(raw.photon_mapping_precomputed_irradiance,
+                       args.photon_mapping_precomputed_irradiance))
+    {
+        program::exit(program::err(), "Invalid precomputed irradiance spacing.");
+    }
+
+    if (set(raw.photon_mapping_progressive_iterations)
+        && !readNumber(raw.photon_mapping_progressive_iterations,
+                       args.photon_mapping_progressive_iterations))
+    {
+        program::exit(program::err(), "Invalid number of progressive iterations.");
+    }
+
+    if (set(raw.photon_mapping_progressive_time)
+        && (!readNumber(raw.photon_mapping_progressive_time,
+                        args.photon_mapping_progressive_time)
+            || args.photon_mapping_progressive_time < 0.0) )
+    {
+        program::exit(program::err(), "Invalid progressive time.");
+    }
+
+    if ((args.photon_mapping_progressive_iterations > 0
+         || args.photon_mapping_progressive_time > 0)
+        && args.photon_mapping_hybrid)
+    {
+        program::exit(program::err(), "Progressive photon mapping cannot be hybrid.");
+    }
+
+    if (args.photon_mapping_caustic_photons > 0
+        && (args.photon_mapping_hybrid
+            || args.photon_mapping_progressive_iterations > 0
+            || args.photon_mapping_progressive_time > 0))
+    {
+        program::exit(program::err(), "A caustic map cannot be hybrid nor progressive.");
+    }
+
+    if (args.photon_mapping_final_gathering > 0
+        && (!args.photon_mapping_use_next_event_estimation
+            || args.photon_mapping_caustic_photons == 0
+            || args.photon_mapping_use_russian_roulette
+            || args.photon_mapping_hybrid
+            || args.photon_mapping_progressive_iterations > 0
+            || args.photon_mapping_progressive_time > 0))
+    {
+        program::exit(program::err(), "Final gathering needs next event estimation "
+                                      "and a caustic map, and cannot use russian "
+                                      "roulette, be hybrid nor progressive.");
+    }
+
+    if (args.photon_mapping_precomputed_irradiance > 0
+        && (args.photon_mapping_hybrid
+            || args.photon_mapping_progressive_iterations > 0
+            || args.photon_mapping_progressive_time > 0))
+    {
+        program::exit(program::err(), "Precomputed irradiance cannot be hybrid nor progressive.");
+    }
+
     if (set(raw.photon_mapping_evaluation_radius)
         && (!readNumber(raw.photon_mapping_evaluation_radius,
                         args.photon_mapping_evaluation_radius)
@@ -321,6 +647,20 @@ Arguments processArgs(const RawArguments& raw)
         program::exit(program::err(), "Invalid number of total saved photons.");
     }
 
+    if (set(raw.virtual_point_lights)
+        && !readNumber(raw.virtual_point_lights, args.virtual_point_lights))
+    {
+        program::exit(program::err(), "Invalid number of virtual point lights.");
+    }
+
+    if (set(raw.virtual_point_lights_min_distance)
+        && (!readNumber(raw.virtual_point_lights_min_distance,
+                        args.virtual_point_lights_min_distance)
+            || args.virtual_point_lights_min_distance < 0.0) )
+    {
+        program::exit(program::err(), "Invalid virtual point lights minimum distance.");
+    }
+
     return args;
 }
 
@@ -428,11 +768,46 @@ auto usage(int argc, char *argv[])
             parseOption(raw.paths_per_pixel,
                     "Paths per pixel value", "paths per pixel");
         }
+        else if (pos = checkOpt(str, "-L", "--light-sampling="); pos > 0)
+        {
+            parseOption(raw.light_sampling,
+                    "Light sampling strategy", "light sampling strategy");
+        }
+        else if (pos = checkOpt(str, "-M", "--shadow-maps="); pos > 0)
+        {
+            parseOption(raw.shadow_maps,
+                    "Shadow map resolution", "shadow map resolution");
+        }
         else if (pos = checkOpt(str, "-s", "--path-tracing-strategy="); pos > 0)
         {
             parseOption(raw.path_tracing_strategy,
                     "Path tracing strategy", "path tracing strategy");
         }
+        else if (pos = checkOpt(str, "-S", "--split-factor="); pos > 0)
+        {
+            parseOption(raw.split_factor,
+                    "Split factor", "split factor");
+        }
+        else if (pos = checkOpt(str, "-I", "--irradiance-cache-error="); pos > 0)
+        {
+            parseOption(raw.irradiance_cache_error,
+                    "Irradiance cache error", "irradiance cache error");
+        }
+        else if (pos = checkOpt(str, "-G", "--path-guiding-passes="); pos > 0)
+        {
+            parseOption(raw.path_guiding_passes,
+                    "Path guiding passes", "path guiding passes");
+        }
+        else if (pos = checkOpt(str, "-n", "--noise-threshold="); pos > 0)
+        {
+            parseOption(raw.noise_threshold,
+                    "Noise threshold", "noise threshold");
+        }
+        else if (pos = checkOpt(str, "-F", "--indirect-downsampling="); pos > 0)
+        {
+            parseOption(raw.indirect_downsampling,
+                    "Indirect downsampling factor", "indirect downsampling factor");
+        }
         else if (pos = checkOpt(str, "-N", "--photon-mapping-use-next-event-estimation"); pos > 0)
         {
             parseBoolOption(raw.photon_mapping_use_next_event_estimation,
@@ -448,6 +823,51 @@ auto usage(int argc, char *argv[])
             parseBoolOption(raw.photon_mapping_use_russian_roulette,
                     "Russian roulette flag", "russian roulette flag value");
         }
+        else if (pos = checkOpt(str, "-H", "--photon-mapping-hybrid"); pos > 0)
+        {
+            parseBoolOption(raw.photon_mapping_hybrid,
+                    "Hybrid flag", "hybrid flag value");
+        }
+        else if (pos = checkOpt(str, "-U", "--photon-mapping-hash-grid"); pos > 0)
+        {
+            parseBoolOption(raw.photon_mapping_hash_grid,
+                    "Hash grid flag", "hash grid flag value");
+        }
+        else if (pos = checkOpt(str, "-K", "--photon-mapping-caustic-photons="); pos > 0)
+        {
+            parseOption(raw.photon_mapping_caustic_photons,
+                    "Number of caustic photons", "number of caustic photons");
+        }
+        else if (pos = checkOpt(str, "-k", "--photon-mapping-caustic-radius="); pos > 0)
+        {
+            parseOption(raw.photon_mapping_caustic_radius,
+                    "Caustic evaluation radius", "caustic evaluation radius");
+        }
+        else if (pos = checkOpt(str, "-J", "--photon-mapping-caustic-evaluation-photons="); pos > 0)
+        {
+            parseOption(raw.photon_mapping_caustic_evaluation_photons,
+                    "Number of caustic evaluation photons", "number of caustic evaluation photons");
+        }
+        else if (pos = checkOpt(str, "-g", "--photon-mapping-final-gathering="); pos > 0)
+        {
+            parseOption(raw.photon_mapping_final_gathering,
+                    "Final gathering rays", "number of final gathering rays");
+        }
+        else if (pos = checkOpt(str, "-i", "--photon-mapping-precomputed-irradiance="); pos > 0)
+        {
+            parseOption(raw.photon_mapping_precomputed_irradiance,
+                    "Precomputed irradiance spacing", "precomputed irradiance spacing");
+        }
+        else if (pos = checkOpt(str, "-P", "--photon-mapping-progressive-iterations="); pos > 0)
+        {
+            parseOption(raw.photon_mapping_progressive_iterations,
+                    "Progressive iterations", "number of progressive iterations");
+        }
+        else if (pos = checkOpt(str, "-T", "--photon-mapping-progressive-time="); pos > 0)
+        {
+            parseOption(raw.photon_mapping_progressive_time,
+                    "Progressive time", "progressive time");
+        }
         else if (pos = checkOpt(str, "-r", "--photon-mapping-evaluation-radius="); pos > 0)
         {
             parseOption(raw.photon_mapping_evaluation_radius,
@@ -463,6 +883,16 @@ auto usage(int argc, char *argv[])
             parseOption(raw.photon_mapping_total_saved_photons,
                     "Number of saved photons", "number saved photons");
         }
+        else if (pos = checkOpt(str, "-V", "--virtual-point-lights="); pos > 0)
+        {
+            parseOption(raw.virtual_point_lights,
+                    "Number of virtual point lights", "number of virtual point lights");
+        }
+        else if (pos = checkOpt(str, "-m", "--virtual-point-lights-min-distance="); pos > 0)
+        {
+            parseOption(raw.virtual_point_lights_min_distance,
+                    "Virtual point lights minimum distance", "virtual point lights minimum distance");
+        }
         else if (foundSrc && !foundDst) { raw.destination_file = str; foundDst = true; }
         else if (!foundSrc) { raw.scene_file = str; foundSrc = true; }
         else program::exit(program::err(), "Wrong number of arguments.");
@@ -500,6 +930,25 @@ int main(int argc, char* argv[])
         return s.value();
     }();
 
+    if (args.light_tree_samples > 0)
+    {
+        scene.objects.lightTree = LightTree{scene.objects.pointLights, args.light_tree_samples};
+        std::cout << "Light tree: " << scene.objects.lightTree.size() << " nodes, "
+                  << args.light_tree_samples << " light(s) per shading point\n";
+    }
+
+    if (args.shadow_map_resolution > 0)
+    {
+        const auto seconds = measure([&]()
+        {
+            scene.objects.shadowMaps = ShadowMaps{scene.objects, args.shadow_map_resolution};
+        });
+        std::cout << "Shadow maps: " << scene.objects.pointLights.size() << " light(s), "
+                  << args.shadow_map_resolution << "x" << args.shadow_map_resolution
+                  << " texels per face, " << scene.objects.shadowMaps.memory() / 1024.0
+                  << " KiB, built in " << seconds << " s\n";
+    }
+
     Camera camera {scene.focus, scene.front, scene.up, args.dimensions};
     Image img {1, args.color_resolution, args.dimensions};
 
@@ -513,6 +962,12 @@ int main(int argc, char* argv[])
 
         std::cout << "Render finished in " << seconds << " s\n";
 
+        if (const auto [tests, hits] = shadowCacheStats(); tests > 0)
+        {
+            std::cout << "Shadow occluder cache: " << hits << " hits out of "
+                      << tests << " tests (" << 100.0 * hits / tests << " %)\n";
+        }
+
         if (!writer->write(img))
             program::exit(program::err(), "Could not write destination file.");
     };
@@ -520,6 +975,10 @@ int main(int argc, char* argv[])
     switch (args.algorithm)
     {
     case Algorithm::photon_mapping:
+        if (args.photon_mapping_exclusive_evaluation
+                && scene.objects.objects.size() > PhotonMapping::SPhoton::maxObjects)
+            program::exit(program::err(), "Exclusive photon evaluation supports up to ",
+                    PhotonMapping::SPhoton::maxObjects, " objects.");
         render([&]()
         {
             PhotonMapping::TaskDivider divider {args.dimensions, args.task_division};
@@ -527,13 +986,57 @@ int main(int argc, char* argv[])
                 args.task_concurrency, args.task_queue_size, divider
             };
 
+            if (args.photon_mapping_progressive_iterations > 0
+                || args.photon_mapping_progressive_time > 0)
+            {
+                photonMapper.renderProgressive(camera, img, scene.objects,
+                        args.photon_mapping_total_saved_photons,
+                        args.photon_mapping_evaluation_radius,
+                        args.photon_mapping_use_next_event_estimation,
+                        args.photon_mapping_exclusive_evaluation,
+                        args.photon_mapping_hash_grid,
+                        args.photon_mapping_progressive_iterations,
+                        args.photon_mapping_progressive_time);
+                return;
+            }
+
             photonMapper.render(camera, img, scene.objects,
                     args.paths_per_pixel, args.photon_mapping_total_saved_photons,
                     args.photon_mapping_evaluation_radius,
                     args.photon_mapping_evaluation_photons,
                     args.photon_mapping_use_next_event_estimation,
                     args.photon_mapping_exclusive_evaluation,
-                    args.photon_mapping_use_russian_roulette);
+                    args.photon_mapping_use_russian_roulette,
+                    args.photon_mapping_hybrid,
+                    args.photon_mapping_hash_grid,
+                    args.photon_mapping_caustic_photons,
+                    args.photon_mapping_caustic_radius,
+                    args.photon_mapping_caustic_evaluation_photons,
+                    args.photon_mapping_final_gathering,
+                    args.photon_mapping_precomputed_irradiance);
+        });
+        break;
+    case Algorithm::bidirectional_path_tracing:
+        render([&]()
+        {
+            BidirectionalPathTracing::TaskDivider divider {args.dimensions, args.task_division};
+            BidirectionalPathTracing::Renderer bidirectionalPathTracer {
+                args.task_concurrency, args.task_queue_size, divider
+            };
+
+            bidirectionalPathTracer.render(camera, img, scene.objects, args.paths_per_pixel);
+        });
+        break;
+    case Algorithm::instant_radiosity:
+        render([&]()
+        {
+            InstantRadiosity::TaskDivider divider {args.dimensions, args.task_division};
+            InstantRadiosity::Renderer instantRadiosity {
+                args.task_concurrency, args.task_queue_size, divider
+            };
+
+            instantRadiosity.render(camera, img, scene.objects, args.paths_per_pixel,
+                    args.virtual_point_lights, args.virtual_point_lights_min_distance);
         });
         break;
     case Algorithm::path_tracing:
@@ -543,7 +1046,9 @@ int main(int argc, char* argv[])
             PathTracing::TaskDivider divider {args.dimensions, args.task_division};
             PathTracing::Renderer pathTracer {
                 args.task_concurrency, args.task_queue_size, divider,
-                args.path_tracing_strategy
+                args.path_tracing_strategy, args.split_factor,
+                args.irradiance_cache_error, args.path_guiding_passes,
+                args.noise_threshold, args.indirect_downsampling
             };
 
             pathTracer.render(camera, img, scene.objects, args.paths_per_pixel);
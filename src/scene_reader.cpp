@@ -1,5 +1,7 @@
 #include "scene_reader.hpp"
 
+#include <filesystem>
+
 std::optional<Scene> makeSceneFromFile(std::string_view file_name)
 {
     std::ifstream is{std::string{file_name}};
@@ -205,6 +207,37 @@ std::optional<Scene> makeSceneFromFile(std::string_view file_name)
             scene.objects.pointLights.emplace_back(point, emission);
             getline(is, word);
         }
+        else if (word == "Environment")
+        {
+            std::string image;
+            Color scale {1, 1, 1};
+            Real radius = 10;
+            bool ok = false;
+            do {
+                if (!(is >> word)) return std::nullopt;
+                if (word == "image:")
+                {
+                    if (!(is >> image)) return std::nullopt;
+                }
+                else if (word == "emission:")
+                {
+                    if (!parseVec(scale)) return std::nullopt;
+                }
+                else if (word == "radius:")
+                {
+                    if (!parseReal(radius)) return std::nullopt;
+                }
+                else ok = (word == "}");
+            } while (!ok);
+
+            // Relative to the scene file
+            const auto path = std::filesystem::path{file_name}.parent_path() / image;
+            auto environment = makeEnvironmentLight(path.string(), scale, radius);
+            if (image.empty() || !environment)
+                return std::nullopt;
+            scene.objects.environment = std::move(environment);
+            getline(is, word);
+        }
         else if (word == "Sphere")
         {
             Point center;
@@ -446,6 +479,13 @@ std::optional<Scene> makeSceneFromFile(std::string_view file_name)
     if (!foundCamera)
         return std::nullopt;
 
+    for (const Object& obj : scene.objects.objects)
+    {
+        const auto [emits, ke] = obj.material().emission();
+        if (emits && obj.shape().isBounded())
+            scene.objects.areaLights.emplace_back(&obj.shape(), ke);
+    }
+
     return scene;
 }
 
@@ -0,0 +1,89 @@
+#include "shadow_maps.hpp"
+#include "object_set.hpp"
+#include "ray_tracing.hpp"
+
+#include <limits>
+
+namespace {
+
+// Face of the cube crossed by `d`, and its dominant axis
+struct Face
+{
+    Index index;
+    int axis;
+};
+
+Face face(const Direction& d)
+{
+    int axis = 0;
+    for (int i : {1, 2})
+        if (std::abs(d[i]) > std::abs(d[axis]))
+            axis = i;
+    return {Index(2 * axis + (d[axis] < 0)), axis};
+}
+
+} //namespace
+
+Index ShadowMaps::texel(const Direction& d) const
+{
+    const auto [index, axis] = face(d);
+    const Real major = std::abs(d[axis]);
+
+    // Coordinates in [-1, 1] on the face
+    const Real u = d[(axis + 1) % 3] / major;
+    const Real v = d[(axis + 2) % 3] / major;
+
+    const Index i = numbers::min(Index((u + 1) / 2 * resolution), resolution - 1);
+    const Index j = numbers::min(Index((v + 1) / 2 * resolution), resolution - 1);
+    return (index * resolution + i) * resolution + j;
+}
+
+ShadowMaps::ShadowMaps(const ObjectSet& objSet, Index faceResolution)
+    : resolution{faceResolution}
+{
+    const Index texels = 6 * resolution * resolution;
+    depths.resize(objSet.pointLights.size() * texels);
+
+    for (const PointLight& light : objSet.pointLights)
+    {
+        const Index first = positions.size() * texels;
+        positions.push_back(light.position());
+
+        for (Index f : numbers::range(0, 6))
+        for (Index i : numbers::range(0, resolution))
+        for (Index j : numbers::range(0, resolution))
+        {
+            // Through the centre of the texel
+            const int axis = f / 2;
+            Direction d;
+            d[axis] = f % 2 ? -1 : 1;
+            d[(axis + 1) % 3] = (2 * (i + Real(0.5))) / resolution - 1;
+            d[(axis + 2) % 3] = (2 * (j + Real(0.5))) / resolution - 1;
+
+            const Ray ray {light.position(), normalize(d)};
+            Real depth = std::numeric_limits<Real>::max();
+            for (const Object& obj : objSet.objects)
+            {
+                const auto its = obj.shape().intersect(ray);
+                if (Ray::isHit(its) && its < depth)
+                    depth = its;
+            }
+            depths[first + (f * resolution + i) * resolution + j] = depth;
+        }
+    }
+}
+
+bool ShadowMaps::visible(Index light, const Point& p, Real cosine) const
+{
+    const Direction d = p - positions[light];
+    const Real distance = norm(d);
+
+    // Depth change across a texel on a surface tilted away from the light
+    const Real texelSize = distance * 2 / resolution;
+    const Real cos = numbers::max(std::abs(cosine), Real(0.1));
+    const Real slope = std::sqrt(1 - cos * cos) / cos;
+    const Real bias = 0.001 + texelSize * (1 + slope);
+
+    const Index texels = 6 * resolution * resolution;
+    return distance <= depths[light * texels + texel(d)] + bias;
+}
@@ -6,4 +6,25 @@
 bool DiskBorder::isInside(const Point p, const LimitedPlane<DiskBorder>& plane) const
 {
     return (norm(p - plane.o) < r);
-}
\ No newline at end of file
+}
+
+Real DiskBorder::area() const
+{
+    return numbers::pi * r * r;
+}
+
+Shape::Sample DiskBorder::sample(const LimitedPlane<DiskBorder>& plane, Randomizer& random) const
+{
+    const Direction n = plane.n;
+    const Direction ortogonal1 = (std::abs(n[0]) < 0.1)
+        ? normalize(Direction{0, n[2], -n[1]})
+        : normalize(Direction{n[1], -n[0], 0});
+    const Direction ortogonal2 = cross(ortogonal1, n);
+
+    const Real radius = r * std::sqrt(random());
+    const Real az = 2 * numbers::pi * random();
+
+    const Point p = plane.o + ortogonal1 * (radius * std::cos(az))
+                            + ortogonal2 * (radius * std::sin(az));
+    return {p, n};
+}
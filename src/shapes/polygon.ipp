@@ -14,6 +14,30 @@ bool PolygonBorder::isInside(const Point p, const LimitedPlane<PolygonBorder>& p
     return true;
 }
 
+Real PolygonBorder::area() const
+{
+    return fanAreas.back();
+}
+
+Shape::Sample PolygonBorder::sample(const LimitedPlane<PolygonBorder>& plane, Randomizer& random) const
+{
+    // Choose a triangle of the fan proportionally to its area
+    const Real x = random() * fanAreas.back();
+    Index t = 0;
+    while (t < fanAreas.size() - 1 && fanAreas[t] < x)
+        t++;
+
+    const Point& a = vertices[0];
+    const Point& b = vertices[t + 1];
+    const Point& c = vertices[t + 2];
+
+    // Uniform barycentric coordinates
+    const Real su = std::sqrt(random());
+    const Real u = 1 - su, v = random() * su;
+
+    return {a + (b - a) * (1 - u - v) + (c - a) * v, plane.n};
+}
+
 
 Polygon::Polygon(Direction normal, Point origin, Point reference,
         const std::vector<FlatPoint>& points, bool solid)
@@ -32,4 +56,12 @@ Polygon::Polygon(Direction normal, Point origin, Point reference,
         this->border.vertices.emplace_back(planeToScene * Point{x, y, 0});
     }
     this->border.vertices.shrink_to_fit();
-}
\ No newline at end of file
+
+    const auto& vertices = this->border.vertices;
+    Real accumulated = 0;
+    for (Index v : numbers::range(1, vertices.size() - 1))
+    {
+        accumulated += norm(cross(vertices[v] - vertices[0], vertices[v + 1] - vertices[0])) / 2;
+        this->border.fanAreas.push_back(accumulated);
+    }
+}
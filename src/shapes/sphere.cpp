@@ -37,3 +37,13 @@ Shape::Normal Sphere::normal(const Direction d, const Point hit) const
     else
         return {Side::out, n / r}; // fuera
 }
+
+Shape::Sample Sphere::sample(Randomizer& random) const
+{
+    const Real cosLat = 2 * random() - 1;
+    const Real sinLat = std::sqrt(1 - cosLat * cosLat);
+    const Real az = 2 * numbers::pi * random();
+
+    const Direction n {sinLat * std::sin(az), cosLat, sinLat * std::cos(az)};
+    return {c + n * r, n};
+}
@@ -0,0 +1,75 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "fast_math.hpp"
+
+// Time of the approximations of fast_math.hpp against the standard library
+// over the same arguments.
+
+double benchmark(const std::vector<Real>& args, auto lambda)
+{
+    volatile Real sink = 0;
+    auto start = std::chrono::system_clock::now();
+
+    Real sum = 0;
+    for (Real x : args)
+        sum += lambda(x);
+
+    auto end = std::chrono::system_clock::now();
+    sink = sum;
+    (void) sink;
+    return std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count();
+}
+
+void compare(const char* name, const std::vector<Real>& args, auto fast, auto libm)
+{
+    const double fastTime = benchmark(args, fast);
+    const double libmTime = benchmark(args, libm);
+    std::cout << name << ": " << fastTime * 1e9 / args.size() << " ns vs "
+              << libmTime * 1e9 / args.size() << " ns (libm), x"
+              << libmTime / fastTime << '\n';
+}
+
+int main()
+{
+    constexpr int count = 20'000'000;
+
+    std::vector<Real> angles(count), cosines(count), positives(count);
+    for (int i = 0; i < count; i++)
+    {
+        // Pseudo-random order, so that branches are not predictable
+        const Real u = Real((i * 7919LL) % count) / count;
+        angles[i] = 2 * numbers::pi * u;
+        cosines[i] = 2 * u - 1;
+        positives[i] = 1e-3 + 100 * u;
+    }
+
+    compare("sincos", angles,
+            [](Real x) { const auto [s, c] = fastmath::sincos(x); return s + c; },
+            [](Real x) { return std::sin(x) + std::cos(x); });
+    compare("acos", cosines,
+            [](Real x) { return fastmath::acos(x); },
+            [](Real x) { return std::acos(x); });
+    compare("rsqrt", positives,
+            [](Real x) { return fastmath::rsqrt(x); },
+            [](Real x) { return 1 / std::sqrt(x); });
+
+    const Direction n {0, 0, 1};
+    compare("refract", cosines,
+            [&](Real x)
+            {
+                const Direction d = fastmath::cosineHemisphere(x * x, (x + 1) / 2);
+                return fastmath::refract(d, n, Real(1) / Real(1.5)).d[2];
+            },
+            [&](Real x)
+            {
+                // Previous form, through the angles
+                const Real sinLat = std::sqrt(x * x), cosLat = std::sqrt(1 - x * x);
+                const Real az = numbers::pi * (x + 1);
+                const Direction d {sinLat * std::cos(az), sinLat * std::sin(az), cosLat};
+                const Real sinIn = std::sin(std::acos(dot(d, n))) / Real(1.5);
+                return std::cos(std::asin(sinIn));
+            });
+}
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "kdtree/kdtree.hpp"
+#include "kdtree/bucket_kdtree.hpp"
+#include "kdtree/hash_grid.hpp"
+
+// Gather throughput of the layouts of the kd-tree and the hash grid over a
+// photon-map-like set: a million points on the faces of the unit cube, with
+// around fifty of them within the radius of each query.
+
+using Point3 = std::array<float, 3>;
+using KDTree = nn::KDTree<Point3, 3, nn::RandomAccess>;
+template<std::size_t L> using BucketKDTree = nn::BucketKDTree<Point3, 3, nn::RandomAccess, L>;
+using HashGrid = nn::HashGrid<Point3, 3, nn::RandomAccess>;
+
+double seconds(auto start)
+{
+    auto end = std::chrono::system_clock::now();
+    return std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count();
+}
+
+// `make()` builds the structure
+template<typename Tree>
+void benchmark(const char* name, const std::vector<Point3>& queries,
+        float radius, std::size_t k, auto make)
+{
+    auto start = std::chrono::system_clock::now();
+    const Tree tree = make();
+    const double build = seconds(start);
+
+    volatile float sink = 0;
+    float sum = 0;
+    start = std::chrono::system_clock::now();
+    for (const Point3& p : queries)
+        tree.for_each_in_radius(p, radius, [&](const Point3& q, float) { sum += q[0]; });
+    const double radiusTime = seconds(start);
+
+    std::vector<typename Tree::neighbor> storage(k);
+    start = std::chrono::system_clock::now();
+    for (const Point3& p : queries)
+        sum += tree.nearest_neighbors(p, std::span{storage}, radius);
+    const double nearestTime = seconds(start);
+
+    sink = sum;
+    (void) sink;
+    std::cout << name << ": build " << build << " s, radius "
+              << radiusTime * 1e9 / queries.size() << " ns/query, "
+              << k << " nearest " << nearestTime * 1e9 / queries.size() << " ns/query\n";
+}
+
+int main()
+{
+    constexpr int numPoints = 1'000'000, numQueries = 200'000;
+    constexpr float radius = 0.01;
+    constexpr std::size_t k = 50;
+
+    std::mt19937 gen {42};
+    std::uniform_real_distribution<float> uniform {0, 1};
+    auto randomPoint = [&]
+    {
+        Point3 p {uniform(gen), uniform(gen), uniform(gen)};
+        const int face = gen() % 6;
+        p[face / 2] = face % 2;
+        return p;
+    };
+
+    std::vector<Point3> points(numPoints), queries(numQueries);
+    for (auto& p : points)
+        p = randomPoint();
+    for (auto& q : queries)
+        q = randomPoint();
+
+    const unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    benchmark<KDTree>("KDTree", queries, radius, k, [&] { return KDTree{points}; });
+    benchmark<BucketKDTree<8>>("BucketKDTree<8>", queries, radius, k,
+            [&] { return BucketKDTree<8>{points}; });
+    benchmark<BucketKDTree<16>>("BucketKDTree<16>", queries, radius, k,
+            [&] { return BucketKDTree<16>{points}; });
+    benchmark<BucketKDTree<32>>("BucketKDTree<32>", queries, radius, k,
+            [&] { return BucketKDTree<32>{points}; });
+    std::cout << "(" << threads << " thread(s)) ";
+    benchmark<BucketKDTree<32>>("BucketKDTree<32>", queries, radius, k,
+            [&] { return BucketKDTree<32>{points, {}, threads}; });
+    benchmark<HashGrid>("HashGrid", queries, radius, k,
+            [&] { return HashGrid{points, radius}; });
+}
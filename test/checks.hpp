@@ -0,0 +1,24 @@
+#pragma once
+
+#include <iostream>
+
+// Checks shared by the tests, whose main returns the number of failed checks
+
+inline int failures = 0;
+
+inline void check(const char* name, bool ok)
+{
+    std::cout << (ok ? "[ OK ] " : "[FAIL] ") << name << '\n';
+    if (!ok)
+        failures++;
+}
+
+// Passes if `error` is within `bound`
+inline void check(const char* name, double error, double bound)
+{
+    const bool ok = error <= bound;
+    std::cout << (ok ? "[ OK ] " : "[FAIL] ") << name << ": max error "
+              << error << " (bound " << bound << ")\n";
+    if (!ok)
+        failures++;
+}
@@ -0,0 +1,93 @@
+#include <cmath>
+#include <numbers>
+#include <iostream>
+#include <random>
+
+#include "fast_math.hpp"
+#include "checks.hpp"
+
+// Checks the maximum errors documented in fast_math.hpp
+
+int main()
+{
+    constexpr int steps = 2'000'000;
+
+    for (const double range : {2 * std::numbers::pi, 100.0})
+    {
+        double sinError = 0, cosError = 0;
+        for (int i = 0; i <= steps; i++)
+        {
+            const Real x = Real(range * (-1 + 2.0 * i / steps));
+            const auto [s, c] = fastmath::sincos(x);
+            sinError = std::max(sinError, std::abs(s - std::sin(double(x))));
+            cosError = std::max(cosError, std::abs(c - std::cos(double(x))));
+        }
+        const double bound = range < 10 ? 2e-7 : 6e-6;
+        std::cout << "|x| <= " << range << '\n';
+        check("sincos (sin)", sinError, bound);
+        check("sincos (cos)", cosError, bound);
+    }
+
+    double acosError = 0;
+    for (int i = 0; i <= steps; i++)
+    {
+        const Real x = Real(-1 + 2.0 * i / steps);
+        acosError = std::max(acosError, std::abs(fastmath::acos(x) - std::acos(double(x))));
+    }
+    check("acos", acosError, 5e-7);
+
+    double rsqrtError = 0;
+    for (int i = 0; i <= steps; i++)
+    {
+        // Every exponent from 1e-30 to 1e30
+        const Real x = Real(std::pow(10.0, -30 + 60.0 * i / steps));
+        const double exact = 1 / std::sqrt(double(x));
+        rsqrtError = std::max(rsqrtError, std::abs(fastmath::rsqrt(x) - exact) / exact);
+    }
+    check("rsqrt (relative)", rsqrtError, 5e-6);
+
+    std::mt19937 gen {42};
+    std::uniform_real_distribution<double> uniform {0, 1};
+
+    // Cosine-weighted hemisphere: unit length, upper half, E[cos] = 2/3
+    double lengthError = 0, meanCos = 0;
+    bool below = false;
+    constexpr int samples = 1'000'000;
+    for (int i = 0; i < samples; i++)
+    {
+        const Direction d = fastmath::cosineHemisphere(Real(uniform(gen)), Real(uniform(gen)));
+        lengthError = std::max(lengthError, std::abs(double(norm(d)) - 1));
+        below = below || d[2] < 0;
+        meanCos += d[2];
+    }
+    meanCos /= samples;
+    check("cosineHemisphere (length)", lengthError, 1e-5);
+    check("cosineHemisphere (below the surface)", below, 0);
+    check("cosineHemisphere (mean cosine)", std::abs(meanCos - 2.0 / 3), 2e-3);
+
+    // Refraction: unit length and Snell's law, total reflection past the
+    // critical angle
+    double snellError = 0, refractedLength = 0;
+    bool wrongTotal = false;
+    const Direction n {0, 0, 1};
+    for (int i = 0; i < samples; i++)
+    {
+        const Direction d = fastmath::cosineHemisphere(Real(uniform(gen)), Real(uniform(gen)));
+        const Real eta = Real(0.5 + 1.5 * uniform(gen));
+        const auto [t, total] = fastmath::refract(d, n, eta);
+
+        const double sinIn = std::sqrt(std::max(0.0, 1.0 - double(d[2]) * d[2]));
+        wrongTotal = wrongTotal || total != (eta * sinIn > 1);
+        refractedLength = std::max(refractedLength, std::abs(double(norm(t)) - 1));
+        if (!total)
+        {
+            const double sinOut = std::sqrt(std::max(0.0, 1.0 - double(t[2]) * t[2]));
+            snellError = std::max(snellError, std::abs(sinOut - eta * sinIn));
+        }
+    }
+    check("refract (length)", refractedLength, 1e-5);
+    check("refract (Snell's law)", snellError, 1e-3);
+    check("refract (total reflection)", wrongTotal, 0);
+
+    return failures;
+}
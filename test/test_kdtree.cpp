@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "kdtree/kdtree.hpp"
+#include "kdtree/bucket_kdtree.hpp"
+#include "kdtree/hash_grid.hpp"
+#include "checks.hpp"
+
+// Checks the queries of nn::KDTree, nn::BucketKDTree and nn::HashGrid
+// against a linear search of the points
+
+using Point3 = std::array<float, 3>;
+
+float squaredDistance(const Point3& a, const Point3& b)
+{
+    float s = 0;
+    for (int i = 0; i < 3; i++)
+        s += (a[i] - b[i]) * (a[i] - b[i]);
+    return s;
+}
+
+// Squared distances from `p` to the points within `radius`, sorted
+std::vector<float> linearSearch(const std::vector<Point3>& points,
+        const Point3& p, float radius)
+{
+    std::vector<float> d2;
+    for (const auto& q : points)
+        if (squaredDistance(p, q) < radius * radius)
+            d2.push_back(squaredDistance(p, q));
+    std::sort(d2.begin(), d2.end());
+    return d2;
+}
+
+template<typename Tree>
+void checkTree(const char* name, const Tree& tree, const std::vector<Point3>& points,
+        const std::vector<Point3>& queries, float radius, std::size_t k)
+{
+    std::cout << name << '\n';
+    check("size", tree.size() == points.size());
+
+    bool radiusOk = true, nearestOk = true, allocatingOk = true;
+    std::vector<typename Tree::neighbor> storage(k);
+    for (const Point3& p : queries)
+    {
+        const auto expected = linearSearch(points, p, radius);
+
+        std::vector<float> visited;
+        tree.for_each_in_radius(p, radius,
+                [&](const Point3& point, float d2)
+                {
+                    radiusOk = radiusOk && d2 == squaredDistance(p, point);
+                    visited.push_back(d2);
+                });
+        std::sort(visited.begin(), visited.end());
+        radiusOk = radiusOk && visited == expected;
+
+        const std::size_t found = tree.nearest_neighbors(p, std::span{storage}, radius);
+        std::vector<float> nearest;
+        for (std::size_t i = 0; i < found; i++)
+            nearest.push_back(storage[i].squared_distance);
+        std::sort(nearest.begin(), nearest.end());
+        nearestOk = nearestOk && found == std::min(k, expected.size())
+                 && std::equal(nearest.begin(), nearest.end(), expected.begin());
+
+        // Same neighbors as the allocating form, if the tree has it
+        if constexpr (requires { tree.nearest_neighbors(p, k, radius); })
+        {
+            std::vector<float> allocating;
+            for (const Point3* point : tree.nearest_neighbors(p, k, radius))
+                allocating.push_back(squaredDistance(p, *point));
+            std::sort(allocating.begin(), allocating.end());
+            allocatingOk = allocatingOk && allocating == nearest;
+        }
+    }
+
+    check("for_each_in_radius visits every point within the radius", radiusOk);
+    check("nearest_neighbors into storage finds the k nearest", nearestOk);
+    check("nearest_neighbors into storage matches the allocating form", allocatingOk);
+}
+
+// Trees built by several threads are the same as the one built by one,
+// so they visit the same points in the same order
+void checkParallelBuild(const std::vector<Point3>& points,
+        const std::vector<Point3>& queries, float radius)
+{
+    using Tree = nn::BucketKDTree<Point3, 3, nn::RandomAccess>;
+    std::cout << "BucketKDTree (parallel build)\n";
+
+    const Tree serial {points, {}, 1}, parallel {points, {}, 8};
+    bool same = true;
+    for (const Point3& p : queries)
+    {
+        std::vector<Point3> a, b;
+        serial.for_each_in_radius(p, radius, [&](const Point3& q, float) { a.push_back(q); });
+        parallel.for_each_in_radius(p, radius, [&](const Point3& q, float) { b.push_back(q); });
+        same = same && a == b;
+    }
+    check("8 threads build the same tree as 1", same);
+}
+
+int main()
+{
+    constexpr int numPoints = 20'000, numQueries = 500;
+    constexpr float radius = 0.1;
+    constexpr std::size_t k = 16;
+
+    std::mt19937 gen {42};
+    std::uniform_real_distribution<float> uniform {0, 1};
+    auto randomPoint = [&] { return Point3{uniform(gen), uniform(gen), uniform(gen)}; };
+
+    std::vector<Point3> points(numPoints), queries(numQueries);
+    for (auto& p : points)
+        p = randomPoint();
+    for (auto& q : queries)
+        q = randomPoint();
+
+    // Repeated points, which land on both sides of the splits
+    for (int i = 0; i < numPoints / 10; i++)
+        points[i] = points[numPoints - 1 - i % 7];
+
+    using nn::RandomAccess;
+    checkTree("KDTree", nn::KDTree<Point3, 3, RandomAccess>{points},
+            points, queries, radius, k);
+    checkTree("BucketKDTree (leaves of 8)", nn::BucketKDTree<Point3, 3, RandomAccess, 8>{points},
+            points, queries, radius, k);
+    checkTree("BucketKDTree (leaves of 32)", nn::BucketKDTree<Point3, 3, RandomAccess, 32>{points},
+            points, queries, radius, k);
+    checkTree("BucketKDTree (leaves of 13)", nn::BucketKDTree<Point3, 3, RandomAccess, 13>{points},
+            points, queries, radius, k);
+    checkTree("HashGrid", nn::HashGrid<Point3, 3, RandomAccess>{points, radius},
+            points, queries, radius, k);
+    checkTree("HashGrid (queries past its radius)", nn::HashGrid<Point3, 3, RandomAccess>{points, radius / 3},
+            points, queries, radius, k);
+
+    // Large enough for the top levels to be built by separate threads
+    std::vector<Point3> manyPoints(300'000);
+    for (auto& p : manyPoints)
+        p = randomPoint();
+    checkParallelBuild(manyPoints, queries, radius / 4);
+
+    return failures;
+}
@@ -0,0 +1,58 @@
+#include <cmath>
+#include <iostream>
+#include <numbers>
+#include <random>
+
+#include "photon_mapping.hpp"
+#include "checks.hpp"
+
+// Checks the errors of the packed photon encodings documented in
+// photon_mapping.hpp
+
+using namespace PhotonMapping;
+
+int main()
+{
+    constexpr int samples = 1'000'000;
+
+    std::mt19937 gen {42};
+    std::uniform_real_distribution<Real> uniform {0, 1};
+
+    check("Photon and SPhoton take up to 20 bytes",
+            sizeof(Photon) <= 20 && sizeof(SPhoton) <= 20);
+
+    // Relative to the largest channel, over fluxes from 1e-20 to 1e20
+    double fluxError = 0;
+    for (int i = 0; i < samples; i++)
+    {
+        const Real scale = std::pow(Real(10), 40 * uniform(gen) - 20);
+        const RGBPixel c = Color{uniform(gen), uniform(gen), uniform(gen)} * scale;
+        const RGBPixel decoded = Color(PackedFlux{Color{c.r, c.g, c.b}});
+        const double largest = std::max({c.r, c.g, c.b});
+        fluxError = std::max({fluxError,
+                std::abs(decoded.r - c.r) / largest,
+                std::abs(decoded.g - c.g) / largest,
+                std::abs(decoded.b - c.b) / largest});
+    }
+    check("PackedFlux (relative)", fluxError, 0.004);
+
+    const RGBPixel zero = Color(PackedFlux{Color{}});
+    check("PackedFlux keeps zero", zero.r == 0 && zero.g == 0 && zero.b == 0);
+
+    // In degrees, over uniform directions
+    double directionError = 0;
+    for (int i = 0; i < samples; i++)
+    {
+        const Real cosLat = 2 * uniform(gen) - 1;
+        const Real sinLat = std::sqrt(1 - cosLat * cosLat);
+        const Real az = 2 * std::numbers::pi_v<Real> * uniform(gen);
+        const Direction d {sinLat * std::sin(az), sinLat * std::cos(az), cosLat};
+        const Direction decoded = PackedDirection{d};
+        const Real cosAngle = d[0] * decoded[0] + d[1] * decoded[1] + d[2] * decoded[2];
+        directionError = std::max(directionError,
+                std::acos(std::min(double(cosAngle), 1.0)) * 180 / std::numbers::pi);
+    }
+    check("PackedDirection (degrees)", directionError, 1);
+
+    return failures;
+}
@@ -0,0 +1,59 @@
+#include <iostream>
+#include <memory>
+
+#include "photon_mapping.hpp"
+#include "checks.hpp"
+
+// Checks that the light read from a separate caustic map is the one read
+// from a single map, on a red floor lit by a point light through a mirror,
+// so that a flux weighted by the reflectance of the floor stands out
+
+using namespace PhotonMapping;
+
+// Mean of the pixels of a render of `objects`, with `causticPhotons`
+// photons in a caustic map of their own
+RGBPixel meanRadiance(const ObjectSet& objects, Index causticPhotons)
+{
+    const Dimensions dim {16, 16};
+    const Camera camera {Point{0, 1, -1}, Direction{0, -2, 0}, Direction{0, 0, 1}, dim};
+    Image img {1, 255, dim};
+
+    Renderer renderer {Renderer::totalConcurrency, 100, TaskDivider{dim, {4, 4}}};
+    renderer.render(camera, img, objects, 4, 200'000, 0.1, 200'000,
+            false, false, false, false, false, causticPhotons, 0.1, 200'000);
+
+    Real r = 0, g = 0, b = 0;
+    for (Index i : numbers::range(0, dim.height))
+    for (Index j : numbers::range(0, dim.width))
+    {
+        const RGBPixel p = img(i, j);
+        r += p.r / img.pixels();
+        g += p.g / img.pixels();
+        b += p.b / img.pixels();
+    }
+    return {r, g, b};
+}
+
+int main()
+{
+    ObjectSet objects;
+    objects.objects.emplace_back(
+            std::make_shared<Plane>(Point{0, -1, 0}, Direction{0, 1, 0}),
+            std::make_shared<Material>(diffuse(Color{0.8, 0.05, 0.05})));
+    objects.objects.emplace_back(
+            std::make_shared<Plane>(Point{0, 0, 1}, Direction{0, 0, -1}),
+            std::make_shared<Material>(specular(Color{0.9, 0.9, 0.9})));
+    objects.pointLights.emplace_back(Point{0, 0, 0.5}, Color{1, 1, 1});
+
+    const RGBPixel single = meanRadiance(objects, 0);
+    const RGBPixel separate = meanRadiance(objects, 200'000);
+
+    std::cout << "Single map: " << single.r << ' ' << single.g << ' ' << single.b << '\n'
+              << "Caustic map: " << separate.r << ' ' << separate.g << ' ' << separate.b << '\n';
+
+    // Relative to the light of the single map, which has some noise
+    check("Caustic map (red)", std::abs(separate.r - single.r) / single.r, 0.05);
+    check("Caustic map (green)", std::abs(separate.g - single.g) / single.g, 0.05);
+
+    return failures;
+}